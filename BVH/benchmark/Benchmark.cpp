@@ -0,0 +1,1155 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BackgroundBVH.h"
+#include "BVH.h"
+#include "BVHFile.h"
+#include "DynamicTree.h"
+#include "GenericBVH.h"
+#include "SceneFile.h"
+#include "Shapes.h"
+#include "Visuals.h"
+
+/* Headless benchmark of the BVH against a brute force search.
+ * Generates synthetic scenes of increasing size and reports build times, per query latency percentiles and throughput.
+ *
+ * Usage: bvh_benchmark [--min objects] [--max objects] [--queries count] [--scene uniform|clustered|skewed|all] [--seed value]
+ *                      [--leaf objects]
+ */
+
+struct BENCHMARK_SETTINGS {
+	uint32_t minObjects = 1000;
+	uint32_t maxObjects = 10000000;
+	uint32_t queryCount = 10000;
+	std::string scene = "all";
+	uint32_t seed = 1234;
+
+	// The exact SAH sweep sorts every node twice, so it is skipped on scenes larger than this
+	uint32_t maxSAHObjects = 1000000;
+	// Brute force is O(n) per query, the number of queries is cut down so each size takes roughly the same time
+	uint64_t bruteForceBudget = 200000000;
+	// Number of neighbours found by the nearest object queries
+	uint32_t nearestCount = 8;
+	// Largest number of objects in a leaf, passed to every build
+	uint32_t maxLeafObjects = 2;
+	// Checking every pair of objects is O(n^2), so the colliding pairs are only checked against it on scenes up to this size
+	uint32_t maxBruteForcePairObjects = 20000;
+};
+BENCHMARK_SETTINGS SETTINGS;
+
+using Clock = std::chrono::steady_clock;
+
+enum class Scene {
+	Uniform,		// Evenly spread objects of similar size
+	Clustered,		// Objects packed around a few hundred centres, with empty space in between
+	SizeSkewed		// Evenly spread, but sizes follow a power law so a few objects are huge
+};
+
+const char* SceneName(Scene scene)
+{
+	switch (scene)
+	{
+	case Scene::Uniform: return "uniform";
+	case Scene::Clustered: return "clustered";
+	case Scene::SizeSkewed: return "skewed";
+	}
+	return "";
+}
+
+// The world grows with the object count, so every scene has roughly the same density
+float WorldSize(uint32_t objectCount)
+{
+	return std::sqrt(static_cast<float>(objectCount)) * 32.0f;
+}
+
+void GenerateScene(Scene scene, uint32_t objectCount, std::mt19937& random)
+{
+	float worldSize = WorldSize(objectCount);
+	std::uniform_real_distribution<float> position(0.0f, worldSize);
+	std::uniform_real_distribution<float> size(4.0f, 32.0f);
+
+	gameObjectBounds.Clear();
+	gameObjectBounds.minX.reserve(objectCount);
+	gameObjectBounds.minY.reserve(objectCount);
+	gameObjectBounds.maxX.reserve(objectCount);
+	gameObjectBounds.maxY.reserve(objectCount);
+
+	if (scene == Scene::Uniform)
+	{
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			gameObjectBounds.Add(FloatRect(position(random), position(random), size(random), size(random)));
+		}
+	}
+	else if (scene == Scene::Clustered)
+	{
+		uint32_t clusterCount = std::max(1u, objectCount / 1000);
+		std::vector<float> clusterX(clusterCount), clusterY(clusterCount);
+		for (uint32_t i = 0; i < clusterCount; i++)
+		{
+			clusterX[i] = position(random);
+			clusterY[i] = position(random);
+		}
+
+		std::uniform_int_distribution<uint32_t> cluster(0, clusterCount - 1);
+		std::normal_distribution<float> offset(0.0f, worldSize / std::sqrt(static_cast<float>(clusterCount)) * 0.05f);
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			uint32_t c = cluster(random);
+			gameObjectBounds.Add(FloatRect(clusterX[c] + offset(random), clusterY[c] + offset(random), size(random), size(random)));
+		}
+	}
+	else
+	{
+		// Pareto distributed sizes, capped to a tenth of the world
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		auto skewedSize = [&]()
+		{
+			float s = 4.0f / std::pow(1.0f - unit(random) * 0.999999f, 1.0f / 1.2f);
+			return std::min(s, worldSize * 0.1f);
+		};
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			gameObjectBounds.Add(FloatRect(position(random), position(random), skewedSize(), skewedSize()));
+		}
+	}
+}
+
+// Search boxes are the size of a typical object, spread over the whole world
+std::vector<FloatRect> GenerateQueries(uint32_t objectCount, uint32_t queryCount, std::mt19937& random)
+{
+	std::uniform_real_distribution<float> position(0.0f, WorldSize(objectCount));
+	std::vector<FloatRect> queries;
+	queries.reserve(queryCount);
+	for (uint32_t i = 0; i < queryCount; i++)
+	{
+		queries.emplace_back(position(random), position(random), 32.0f, 32.0f);
+	}
+	return queries;
+}
+
+/* Search boxes that each follow a straight line a few units a frame, like a moving entity querying every frame.
+ * Ordered frame by frame, so query i belongs to entity i % MOVING_ENTITIES.
+ */
+constexpr uint32_t MOVING_ENTITIES = 100;
+
+std::vector<FloatRect> GenerateMovingQueries(const std::vector<FloatRect>& startQueries, uint32_t queryCount, std::mt19937& random)
+{
+	std::uniform_real_distribution<float> velocity(-4.0f, 4.0f);
+	uint32_t entityCount = std::min(MOVING_ENTITIES, static_cast<uint32_t>(startQueries.size()));
+	std::vector<float> velocityX(entityCount), velocityY(entityCount);
+	for (uint32_t entity = 0; entity < entityCount; entity++)
+	{
+		velocityX[entity] = velocity(random);
+		velocityY[entity] = velocity(random);
+	}
+
+	std::vector<FloatRect> queries;
+	queries.reserve(queryCount);
+	for (uint32_t i = 0; entityCount > 0 && i < queryCount; i++)
+	{
+		uint32_t entity = i % entityCount;
+		float frame = static_cast<float>(i / entityCount);
+		FloatRect query = startQueries[entity];
+		query.left += velocityX[entity] * frame;
+		query.top += velocityY[entity] * frame;
+		queries.push_back(query);
+	}
+	return queries;
+}
+
+/* Line of fire probes, in random directions and up to a quarter of the world long.
+ * Stored as FloatRects running from (left, top) along (width, height), so they can be timed by MeasureQueries
+ */
+std::vector<FloatRect> GenerateSegments(uint32_t objectCount, uint32_t segmentCount, std::mt19937& random)
+{
+	float worldSize = WorldSize(objectCount);
+	std::uniform_real_distribution<float> position(0.0f, worldSize);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+	std::uniform_real_distribution<float> length(0.0f, worldSize * 0.25f);
+	std::vector<FloatRect> segments;
+	segments.reserve(segmentCount);
+	for (uint32_t i = 0; i < segmentCount; i++)
+	{
+		float direction = angle(random);
+		float distance = length(random);
+		segments.emplace_back(position(random), position(random), std::cos(direction) * distance, std::sin(direction) * distance);
+	}
+	return segments;
+}
+
+Ray SegmentAsRay(FloatRect segment)
+{
+	return SegmentRay(segment.left, segment.top, segment.left + segment.width, segment.top + segment.height);
+}
+
+float ElapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+struct QueryStats {
+	uint32_t queryCount = 0;
+	uint64_t hits = 0;
+	double p50Us = 0;
+	double p90Us = 0;
+	double p99Us = 0;
+	double maxUs = 0;
+	double queriesPerSecond = 0;
+};
+
+// Times every query on its own, query(searchRect, onObjectHit) is one of the query functions from BVH.h
+template <typename Query>
+QueryStats MeasureQueries(const std::vector<FloatRect>& queries, uint32_t queryCount, Query&& query)
+{
+	QueryStats stats;
+	stats.queryCount = std::min(queryCount, static_cast<uint32_t>(queries.size()));
+
+	std::vector<double> latencies(stats.queryCount);
+	uint64_t hits = 0;
+	auto countHit = [&hits](uint32_t) { hits++; };
+
+	auto start = Clock::now();
+	for (uint32_t i = 0; i < stats.queryCount; i++)
+	{
+		auto t1 = Clock::now();
+		query(queries[i], countHit);
+		latencies[i] = std::chrono::duration<double, std::micro>(Clock::now() - t1).count();
+	}
+	double totalSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double p)
+	{
+		return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+	};
+	stats.hits = hits;
+	stats.p50Us = percentile(0.50);
+	stats.p90Us = percentile(0.90);
+	stats.p99Us = percentile(0.99);
+	stats.maxUs = latencies.empty() ? 0.0 : latencies.back();
+	stats.queriesPerSecond = totalSeconds > 0 ? stats.queryCount / totalSeconds : 0;
+	return stats;
+}
+
+void PrintStatsHeader()
+{
+	std::printf("  %-22s %9s %10s %10s %10s %10s %14s %11s\n", "method", "queries", "p50 us", "p90 us", "p99 us", "max us", "queries/s", "hits/query");
+}
+
+void PrintStats(const char* method, const QueryStats& stats)
+{
+	std::printf("  %-22s %9u %10.2f %10.2f %10.2f %10.2f %14.0f %11.2f\n", method, stats.queryCount,
+		stats.p50Us, stats.p90Us, stats.p99Us, stats.maxUs, stats.queriesPerSecond,
+		stats.queryCount ? static_cast<double>(stats.hits) / stats.queryCount : 0.0);
+}
+
+// Number of checks that did not match brute force, the benchmark fails if it is not 0 by the end
+uint32_t verifyFailures = 0;
+
+/* Checks a BVH query found exactly the objects brute force found, for each of the queries both ran.
+ * The hits of each query are compared sorted, so the order they come in does not matter but a missing, extra or repeated hit does.
+ * bruteForce defaults to BruteForceQuery, and is given in the same form as query
+ */
+template <typename Query, typename BruteForce>
+void VerifyAgainstBruteForce(const char* method, const std::vector<FloatRect>& queries, uint32_t queryCount, Query&& query, BruteForce&& bruteForce)
+{
+	std::vector<uint32_t> expected;
+	std::vector<uint32_t> found;
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0; i < queryCount; i++)
+	{
+		expected.clear();
+		found.clear();
+		bruteForce(queries[i], [&expected](uint32_t object) { expected.push_back(object); });
+		query(queries[i], [&found](uint32_t object) { found.push_back(object); });
+		std::sort(expected.begin(), expected.end());
+		std::sort(found.begin(), found.end());
+		if (expected != found)
+		{
+			mismatches++;
+		}
+	}
+	if (mismatches > 0)
+	{
+		std::printf("  MISMATCH: %s differs from brute force on %u of %u queries\n", method, mismatches, queryCount);
+		verifyFailures++;
+	}
+}
+
+template <typename Query>
+void VerifyAgainstBruteForce(const char* method, const std::vector<FloatRect>& queries, uint32_t queryCount, Query&& query)
+{
+	VerifyAgainstBruteForce(method, queries, queryCount, query,
+		[](FloatRect searchRect, auto&& onObjectHit) { BruteForceQuery(searchRect, onObjectHit); });
+}
+
+// The arrays a build writes, kept from a multi threaded build to compare with the serial build of the same mode
+struct BuiltTree {
+	std::vector<Node> nodes;
+	std::vector<uint32_t> objects;
+	std::vector<uint32_t> leafNodes;
+};
+
+BuiltTree CopyBuiltTree()
+{
+	return { bvh, bvhObjects, objectLeafNodes };
+}
+
+template <typename T>
+bool SameBytes(const std::vector<T>& bufferA, const std::vector<T>& bufferB)
+{
+	return bufferA.size() == bufferB.size() && (bufferA.empty() || std::memcmp(bufferA.data(), bufferB.data(), bufferA.size() * sizeof(T)) == 0);
+}
+
+// Checks the serial build now in bvh came out byte for byte the same as the multi threaded build of the same mode
+void VerifySameAsMultiThreaded(const char* method, const BuiltTree& multiThreaded)
+{
+	if (!SameBytes(multiThreaded.nodes, bvh) || !SameBytes(multiThreaded.objects, bvhObjects) || !SameBytes(multiThreaded.leafNodes, objectLeafNodes))
+	{
+		std::printf("  MISMATCH: %s multi threaded build differs from the serial build\n", method);
+		verifyFailures++;
+	}
+}
+
+/* Segments running exactly along each edge of one box, with no direction across it, must hit the box at the same t
+ * whichever edge they follow. Runs on a scene of that one box, before any scene is generated
+ */
+void VerifyRaysAlongEdges()
+{
+	gameObjectBounds.Add(FloatRect(0, 0, 10, 10));
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+
+	// Forwards they enter the box a fifth of the way along, backwards two fifths
+	const Ray edges[] = { SegmentRay(-5, 0, 20, 0), SegmentRay(-5, 10, 20, 10), SegmentRay(0, -5, 0, 20), SegmentRay(10, -5, 10, 20),
+		SegmentRay(20, 0, -5, 0), SegmentRay(20, 10, -5, 10), SegmentRay(0, 20, 0, -5), SegmentRay(10, 20, 10, -5) };
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		const Ray& edge = edges[i];
+		RayHit hit = CastRay(edge);
+		if (hit.object != 0 || std::abs(hit.t - (i < 4 ? 0.2f : 0.4f)) > 1e-6f)
+		{
+			std::printf("MISMATCH: segment along an edge from (%.0f, %.0f) missed the box\n", edge.originX, edge.originY);
+			verifyFailures++;
+		}
+	}
+
+	gameObjectBounds.Clear();
+	ClearBVH();
+}
+
+/* Times FindCollidingPairs on the current bvh, and on scenes small enough checks it found exactly the pairs
+ * that testing every object against every other finds. Pairs are packed as objectA << 32 | objectB, objectA < objectB
+ */
+void MeasureCollidingPairs(uint32_t objectCount)
+{
+	std::vector<uint64_t> pairs;
+	auto t0 = Clock::now();
+	FindCollidingPairs([&pairs](uint32_t objectA, uint32_t objectB) { pairs.push_back(static_cast<uint64_t>(objectA) << 32 | objectB); });
+	std::printf("  colliding pairs: %8.2f ms  pairs=%zu\n", ElapsedMs(t0), pairs.size());
+	if (objectCount > SETTINGS.maxBruteForcePairObjects)
+	{
+		return;
+	}
+
+	std::vector<uint64_t> expected;
+	for (uint32_t objectA = 0; objectA < objectCount; objectA++)
+	{
+		for (uint32_t objectB = objectA + 1; objectB < objectCount; objectB++)
+		{
+			if (ObjectObjectCollision(objectA, objectB))
+			{
+				expected.push_back(static_cast<uint64_t>(objectA) << 32 | objectB);
+			}
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	if (pairs != expected)
+	{
+		std::printf("  MISMATCH: colliding pairs found %zu pairs, brute force found %zu\n", pairs.size(), expected.size());
+		verifyFailures++;
+	}
+}
+
+/* Times generating the visualiser's vertices for the current bvh, and checks every object is one quad with its bounds as corners
+ * and every depth's layer outlines exactly the nodes at that depth, counted here by walking the tree down from the root
+ */
+void MeasureVisuals()
+{
+	// Node outlines are four bands of four corners each
+	const size_t outlineVertices = 16;
+	uint32_t objectCount = gameObjectBounds.Size();
+	std::vector<VisualColour> colours(objectCount);
+	std::vector<VisualVertex> objectVertices;
+	std::vector<std::vector<VisualVertex>> nodeVertices;
+	auto t0 = Clock::now();
+	BuildObjectVertices(gameObjectBounds, colours, objectVertices);
+	uint32_t depthCount = BuildNodeVertices(bvh, 3.0f, VisualColour(), nodeVertices);
+	std::printf("  visuals:       %10.2f ms  depths=%u\n", ElapsedMs(t0), depthCount);
+
+	bool matches = objectVertices.size() == objectCount * 4;
+	for (uint32_t object = 0; matches && object < objectCount; object++)
+	{
+		const VisualVertex* corners = &objectVertices[object * 4];
+		matches = corners[0].x == gameObjectBounds.minX[object] && corners[0].y == gameObjectBounds.minY[object] &&
+			corners[2].x == gameObjectBounds.maxX[object] && corners[2].y == gameObjectBounds.maxY[object];
+	}
+
+	std::vector<size_t> nodesAtDepth;
+	std::vector<std::pair<uint32_t, uint32_t>> stack;
+	if (!bvh.empty())
+	{
+		stack.push_back({ 0, 0 });
+	}
+	while (!stack.empty())
+	{
+		uint32_t nodeIndex = stack.back().first;
+		uint32_t depth = stack.back().second;
+		stack.pop_back();
+		nodesAtDepth.resize(std::max<size_t>(nodesAtDepth.size(), depth + 1));
+		nodesAtDepth[depth]++;
+		if (!bvh[nodeIndex].IsLeaf())
+		{
+			stack.push_back({ nodeIndex + 1, depth + 1 });
+			stack.push_back({ bvh[nodeIndex].childB, depth + 1 });
+		}
+	}
+
+	size_t nodeVertexCount = 0;
+	matches = matches && depthCount == nodesAtDepth.size();
+	for (uint32_t depth = 0; matches && depth < depthCount; depth++)
+	{
+		matches = nodeVertices[depth].size() == nodesAtDepth[depth] * outlineVertices;
+		nodeVertexCount += nodeVertices[depth].size();
+	}
+	if (!matches || nodeVertexCount != bvh.size() * outlineVertices)
+	{
+		std::printf("  MISMATCH: visuals do not have one quad per object and one outline per node at its depth\n");
+		verifyFailures++;
+	}
+}
+
+/* Saves the generated scene as CSV and binary, then times loading each back in.
+ * Binary is loaded last, it reads back exactly what was saved so the scene is left the same as generated.
+ */
+void MeasureSceneLoading(uint32_t objectCount)
+{
+	const char* scenePaths[] = { "bvh_benchmark_scene.csv", "bvh_benchmark_scene.bin" };
+	SceneFormat sceneFormats[] = { SceneFormat::CSV, SceneFormat::Binary };
+	const char* formatNames[] = { "csv", "binary" };
+	for (int i = 0; i < 2; i++)
+	{
+		bool loaded = SaveScene(scenePaths[i], sceneFormats[i]);
+		gameObjectBounds.Clear();
+		auto t1 = Clock::now();
+		loaded = loaded && LoadScene(scenePaths[i]);
+		float loadMs = ElapsedMs(t1);
+		std::remove(scenePaths[i]);
+		if (!loaded || gameObjectBounds.Size() != objectCount)
+		{
+			std::printf("  load %s: failed, loaded %u of %u objects\n", formatNames[i], gameObjectBounds.Size(), objectCount);
+			std::exit(1);
+		}
+		std::printf("  load %-8s %10.2f ms  %.1f M objects/s\n", formatNames[i], loadMs, loadMs > 0 ? objectCount / (loadMs * 1000.0) : 0.0);
+	}
+}
+
+/* Gives the objects exact shapes inscribed in their boxes, a quarter each of boxes, circles, capsules and diamonds,
+ * then times box and circle queries through the exact tests and reports how many of the bounding box hits they kept.
+ * Circles shrink the bounds of objects that are not square, so this runs after everything else on the scene.
+ */
+void MeasureShapeQueries(const std::vector<FloatRect>& queries, uint32_t verifyQueries)
+{
+	for (uint32_t object = 0; object < gameObjectBounds.Size(); object++)
+	{
+		FloatRect box = gameObjectBounds.Get(object);
+		float centreX = box.left + box.width * 0.5f;
+		float centreY = box.top + box.height * 0.5f;
+		float radius = std::min(box.width, box.height) * 0.5f;
+		switch (object % 4)
+		{
+		case 1:
+			SetCircleShape(object, { centreX, centreY, radius });
+			break;
+		case 2:
+			if (box.width > box.height)
+			{
+				SetCapsuleShape(object, { box.left + radius, centreY, box.left + box.width - radius, centreY, radius });
+			}
+			else
+			{
+				SetCapsuleShape(object, { centreX, box.top + radius, centreX, box.top + box.height - radius, radius });
+			}
+			break;
+		case 3:
+		{
+			float x[] = { centreX, box.left + box.width, centreX, box.left };
+			float y[] = { box.top, centreY, box.top + box.height, centreY };
+			SetPolygonShape(object, x, y, 4);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+
+	// Circle queries use the circle inscribed in each query box
+	ShapeQueryScratch shapeScratch;
+	std::vector<uint32_t> shapeHits;
+	uint64_t candidates = 0;
+	auto queryBoxShapes = [&shapeScratch, &shapeHits, &candidates](FloatRect searchRect, auto&& onObjectHit)
+	{
+		shapeHits.clear();
+		uint32_t candidateCount = 0;
+		QueryShapes(shapeScratch, searchRect, shapeHits, &candidateCount);
+		candidates += candidateCount;
+		for (uint32_t object : shapeHits)
+		{
+			onObjectHit(object);
+		}
+	};
+	auto queryCircleShapes = [&shapeScratch, &shapeHits, &candidates](FloatRect searchRect, auto&& onObjectHit)
+	{
+		shapeHits.clear();
+		uint32_t candidateCount = 0;
+		float radius = std::min(searchRect.width, searchRect.height) * 0.5f;
+		QueryShapes(shapeScratch, CircleShape{ searchRect.left + searchRect.width * 0.5f, searchRect.top + searchRect.height * 0.5f, radius }, shapeHits, &candidateCount);
+		candidates += candidateCount;
+		for (uint32_t object : shapeHits)
+		{
+			onObjectHit(object);
+		}
+	};
+	auto bruteForceBoxShapes = [&shapeHits](FloatRect searchRect, auto&& onObjectHit)
+	{
+		shapeHits.clear();
+		BruteForceQueryShapes(searchRect, shapeHits);
+		for (uint32_t object : shapeHits)
+		{
+			onObjectHit(object);
+		}
+	};
+	auto bruteForceCircleShapes = [&shapeHits](FloatRect searchRect, auto&& onObjectHit)
+	{
+		shapeHits.clear();
+		float radius = std::min(searchRect.width, searchRect.height) * 0.5f;
+		BruteForceQueryShapes(CircleShape{ searchRect.left + searchRect.width * 0.5f, searchRect.top + searchRect.height * 0.5f, radius }, shapeHits);
+		for (uint32_t object : shapeHits)
+		{
+			onObjectHit(object);
+		}
+	};
+	VerifyAgainstBruteForce("bvh shapes box", queries, verifyQueries, queryBoxShapes, bruteForceBoxShapes);
+	VerifyAgainstBruteForce("bvh shapes circle", queries, verifyQueries, queryCircleShapes, bruteForceCircleShapes);
+
+	candidates = 0;
+	QueryStats boxStats = MeasureQueries(queries, SETTINGS.queryCount, queryBoxShapes);
+	uint64_t boxCandidates = candidates;
+	candidates = 0;
+	QueryStats circleStats = MeasureQueries(queries, SETTINGS.queryCount, queryCircleShapes);
+	uint64_t circleCandidates = candidates;
+	ClearShapes();
+
+	PrintStats("bvh shapes box", boxStats);
+	PrintStats("bvh shapes circle", circleStats);
+	// The false positives are the objects whose bounds were hit but whose exact shape was not
+	std::printf("  shape false positives: %.1f%% of bounds hits for boxes, %.1f%% for circles\n",
+		boxCandidates ? 100.0 * (boxCandidates - boxStats.hits) / boxCandidates : 0.0,
+		circleCandidates ? 100.0 * (circleCandidates - circleStats.hits) / circleCandidates : 0.0);
+}
+
+// Copies gameObjectBounds, and puts the copy back when it goes out of scope, around the steps that move objects about
+struct ScopedBoundsRestore {
+	ScopedBoundsRestore() : bounds(gameObjectBounds) {}
+	~ScopedBoundsRestore()
+	{
+		gameObjectBounds = bounds;
+	}
+
+	GameObjectBounds bounds;
+};
+
+// Moves each of the objects up to 16 units along each axis, like a frame of a game would
+template <typename Iterator>
+void MoveObjects(Iterator first, Iterator last, std::mt19937& random)
+{
+	std::uniform_real_distribution<float> offset(-16.0f, 16.0f);
+	for (Iterator object = first; object != last; ++object)
+	{
+		FloatRect boundingBox = gameObjectBounds.Get(*object);
+		boundingBox.left += offset(random);
+		boundingBox.top += offset(random);
+		gameObjectBounds.Set(*object, boundingBox);
+	}
+}
+
+// Moves a tenth of the objects, picked at random so an object can come up more than once, and returns the ones picked
+std::vector<uint32_t> MoveRandomObjects(std::mt19937& random)
+{
+	std::uniform_int_distribution<uint32_t> pickObject(0, gameObjectBounds.Size() - 1);
+	std::vector<uint32_t> movedObjects(std::max(1u, gameObjectBounds.Size() / 10));
+	for (uint32_t& object : movedObjects)
+	{
+		object = pickObject(random);
+	}
+	MoveObjects(movedObjects.begin(), movedObjects.end(), random);
+	return movedObjects;
+}
+
+// Moves a tenth of the objects, then refits the binned tree and times it against a rebuild, checking it against brute force and the rebuilt tree
+void MeasureRefit(const std::vector<FloatRect>& queries, uint32_t verifyQueries, std::mt19937& random)
+{
+	ScopedBoundsRestore generatedScene;
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+	std::vector<uint32_t> movedObjects = MoveRandomObjects(random);
+
+	auto queryBVH = [](FloatRect searchRect, auto&& onObjectHit) { QueryBVH(searchRect, onObjectHit); };
+	auto t0 = Clock::now();
+	RefitBVH(movedObjects);
+	float refitMs = ElapsedMs(t0);
+	VerifyAgainstBruteForce("bvh refit", queries, verifyQueries, queryBVH);
+	QueryStats refitStats = MeasureQueries(queries, SETTINGS.queryCount, queryBVH);
+
+	// Kept to hold against the fresh build, which replaces the refitted tree
+	std::vector<std::vector<uint32_t>> refitHits(verifyQueries);
+	for (uint32_t i = 0; i < verifyQueries; i++)
+	{
+		QueryBVH(queries[i], [&refitHits, i](uint32_t object) { refitHits[i].push_back(object); });
+	}
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+	uint32_t replayedQuery = 0;
+	auto replayRefit = [&refitHits, &replayedQuery](FloatRect, auto&& onObjectHit)
+	{
+		for (uint32_t object : refitHits[replayedQuery++])
+		{
+			onObjectHit(object);
+		}
+	};
+	VerifyAgainstBruteForce("bvh refit against rebuild", queries, verifyQueries, replayRefit, queryBVH);
+	QueryStats rebuiltStats = MeasureQueries(queries, SETTINGS.queryCount, queryBVH);
+
+	std::printf("  refit %zu moved: %8.2f ms  rebuild: %.2f ms\n", movedObjects.size(), refitMs, bvhBuild_timeInMs);
+	PrintStats("bvh binned refitted", refitStats);
+	PrintStats("bvh binned rebuilt", rebuiltStats);
+}
+
+/* Fills a dynamic tree with every object, then removes and inserts a tenth of them again and moves another tenth.
+ * Each step is timed per object against a full binned rebuild, and checked against brute force over the objects in the tree.
+ * The tree should stay within twice the height of a perfectly balanced one.
+ */
+void MeasureDynamicTree(const std::vector<FloatRect>& queries, uint32_t verifyQueries, std::mt19937& random)
+{
+	ScopedBoundsRestore generatedScene;
+	uint32_t objectCount = gameObjectBounds.Size();
+	DynamicTree dynamicTree;
+	std::vector<uint32_t> objectLeaves(objectCount);
+	std::vector<bool> inTree(objectCount, true);
+
+	auto t0 = Clock::now();
+	for (uint32_t object = 0; object < objectCount; object++)
+	{
+		objectLeaves[object] = dynamicTree.Insert(object, gameObjectBounds.Get(object));
+	}
+	float insertMs = ElapsedMs(t0);
+
+	auto queryDynamic = [&dynamicTree](FloatRect searchRect, auto&& onObjectHit) { dynamicTree.Query(searchRect, onObjectHit); };
+	auto bruteForceInTree = [&inTree](FloatRect searchRect, auto&& onObjectHit)
+	{
+		BruteForceQuery(searchRect, [&inTree, &onObjectHit](uint32_t object)
+		{
+			if (inTree[object])
+			{
+				onObjectHit(object);
+			}
+		});
+	};
+	VerifyAgainstBruteForce("dynamic tree inserted", queries, verifyQueries, queryDynamic, bruteForceInTree);
+
+	// A tenth of the objects are removed, then the next tenth moved, then the first tenth inserted again
+	std::vector<uint32_t> shuffledObjects(objectCount);
+	for (uint32_t object = 0; object < objectCount; object++)
+	{
+		shuffledObjects[object] = object;
+	}
+	std::shuffle(shuffledObjects.begin(), shuffledObjects.end(), random);
+	uint32_t changeCount = std::max(1u, objectCount / 10);
+	auto removed = shuffledObjects.begin();
+	auto moved = shuffledObjects.begin() + std::min(changeCount, objectCount);
+	auto movedEnd = shuffledObjects.begin() + std::min(changeCount * 2, objectCount);
+
+	t0 = Clock::now();
+	for (auto object = removed; object != moved; ++object)
+	{
+		dynamicTree.Remove(objectLeaves[*object]);
+		inTree[*object] = false;
+	}
+	float removeMs = ElapsedMs(t0);
+	VerifyAgainstBruteForce("dynamic tree removed", queries, verifyQueries, queryDynamic, bruteForceInTree);
+
+	MoveObjects(moved, movedEnd, random);
+	t0 = Clock::now();
+	for (auto object = moved; object != movedEnd; ++object)
+	{
+		dynamicTree.Update(objectLeaves[*object], gameObjectBounds.Get(*object));
+	}
+	float moveMs = ElapsedMs(t0);
+	VerifyAgainstBruteForce("dynamic tree moved", queries, verifyQueries, queryDynamic, bruteForceInTree);
+
+	t0 = Clock::now();
+	for (auto object = removed; object != moved; ++object)
+	{
+		objectLeaves[*object] = dynamicTree.Insert(*object, gameObjectBounds.Get(*object));
+		inTree[*object] = true;
+	}
+	float reinsertMs = ElapsedMs(t0);
+	VerifyAgainstBruteForce("dynamic tree reinserted", queries, verifyQueries, queryDynamic, bruteForceInTree);
+	QueryStats dynamicStats = MeasureQueries(queries, SETTINGS.queryCount, queryDynamic);
+
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+	auto perObjectUs = [](float ms, uint32_t count) { return count > 0 ? ms * 1000.0f / count : 0.0f; };
+	uint32_t movedCount = static_cast<uint32_t>(movedEnd - moved);
+	std::printf("  dynamic insert: %.3f us  remove: %.3f us  move: %.3f us  reinsert: %.3f us per object, binned rebuild: %.2f ms\n",
+		perObjectUs(insertMs, objectCount), perObjectUs(removeMs, changeCount), perObjectUs(moveMs, movedCount),
+		perObjectUs(reinsertMs, changeCount), bvhBuild_timeInMs);
+
+	int32_t height = dynamicTree.root == NULL_NODE ? 0 : dynamicTree.nodes[dynamicTree.root].height;
+	int32_t balancedHeight = static_cast<int32_t>(std::ceil(std::log2(static_cast<double>(objectCount))));
+	std::printf("  dynamic height: %d, %d if perfectly balanced\n", height, balancedHeight);
+	if (height > 2 * balancedHeight)
+	{
+		std::printf("  FAILED: dynamic tree is %d high for %u objects\n", height, objectCount);
+		verifyFailures++;
+	}
+	PrintStats("dynamic tree", dynamicStats);
+}
+
+/* Times a binned rebuild in the background, where the game only waits for the bounds to be copied, and queries the tree it publishes.
+ * Then rebuilds three more times, moving a tenth of the objects before each. While each rebuild runs the game refits and queries
+ * the tree CreateBVH built, which the rebuilds must leave alone, and both trees are checked against brute force.
+ * Last, bvh is built again while a rebuild runs, and is left built over the moved objects.
+ */
+QueryStats MeasureBackgroundRebuild(const std::vector<FloatRect>& queries, uint32_t verifyQueries, std::mt19937& random)
+{
+	ScopedBoundsRestore generatedScene;
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+
+	auto t0 = Clock::now();
+	StartBVHRebuild(BuildMode::BinnedSurfaceAreaHeuristic, SETTINGS.maxLeafObjects);
+	float startMs = ElapsedMs(t0);
+	WaitForBVHRebuild();
+	std::shared_ptr<const BVHSnapshot> snapshot = AcquireBVHSnapshot();
+	std::printf("  background binned: %6.2f ms  to start, built in %.2f ms\n", startMs, snapshot->buildTimeInMs);
+	auto querySnapshot = [&snapshot](FloatRect searchRect, auto&& onObjectHit) { QueryBVHSnapshot(*snapshot, searchRect, onObjectHit); };
+	auto queryBVH = [](FloatRect searchRect, auto&& onObjectHit) { QueryBVH(searchRect, onObjectHit); };
+	VerifyAgainstBruteForce("bvh snapshot", queries, verifyQueries, querySnapshot);
+	VerifyAgainstBruteForce("bvh beside snapshot", queries, verifyQueries, queryBVH);
+	QueryStats snapshotStats = MeasureQueries(queries, SETTINGS.queryCount, querySnapshot);
+
+	for (int rebuild = 0; rebuild < 3; rebuild++)
+	{
+		std::vector<uint32_t> movedObjects = MoveRandomObjects(random);
+		StartBVHRebuild(BuildMode::BinnedSurfaceAreaHeuristic, SETTINGS.maxLeafObjects);
+		RefitBVH(movedObjects);
+		VerifyAgainstBruteForce("bvh refit during rebuild", queries, verifyQueries, queryBVH);
+		WaitForBVHRebuild();
+		VerifyAgainstBruteForce("bvh refit after rebuild", queries, verifyQueries, queryBVH);
+		snapshot = AcquireBVHSnapshot();
+		VerifyAgainstBruteForce("bvh snapshot after moves", queries, verifyQueries, querySnapshot);
+	}
+
+	// A blocking build and the memory calls started during a rebuild wait for its build scratch space rather than share it
+	StartBVHRebuild(BuildMode::BinnedSurfaceAreaHeuristic, SETTINGS.maxLeafObjects);
+	ReleaseBVHMemory();
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+	BVHMemoryInBytes();
+	VerifyAgainstBruteForce("bvh built during rebuild", queries, verifyQueries, queryBVH);
+	WaitForBVHRebuild();
+	snapshot = AcquireBVHSnapshot();
+	VerifyAgainstBruteForce("bvh snapshot built beside bvh", queries, verifyQueries, querySnapshot);
+	snapshot.reset();
+	return snapshotStats;
+}
+
+// Reads primitive boxes from an array, for the generic trees that are not over gameObjectBounds
+template <int Dimensions, typename Scalar>
+struct BoxArrayAccessor {
+	Box<Dimensions, Scalar> operator()(uint32_t primitive) const
+	{
+		return (*boxes)[primitive];
+	}
+
+	const std::vector<Box<Dimensions, Scalar>>* boxes = nullptr;
+};
+
+// Builds a generic tree over boxes, checks it against testing every box and times its queries. toBox turns each query into a box
+template <int Dimensions, typename Scalar, typename ToBox>
+QueryStats MeasureGenericBVH(const char* method, const std::vector<Box<Dimensions, Scalar>>& boxes, const std::vector<FloatRect>& queries,
+	uint32_t verifyQueries, ToBox&& toBox)
+{
+	GenericBVH<Dimensions, Scalar, BoxArrayAccessor<Dimensions, Scalar>> tree(BoxArrayAccessor<Dimensions, Scalar>{ &boxes });
+	auto t0 = Clock::now();
+	tree.Build(static_cast<uint32_t>(boxes.size()), SETTINGS.maxLeafObjects);
+	std::printf("  build %s: %8.2f ms  nodes=%zu\n", method, ElapsedMs(t0), tree.nodes.size());
+
+	auto query = [&tree, &toBox](FloatRect searchRect, auto&& onObjectHit) { tree.Query(toBox(searchRect), onObjectHit); };
+	auto bruteForce = [&boxes, &toBox](FloatRect searchRect, auto&& onObjectHit)
+	{
+		Box<Dimensions, Scalar> searchBox = toBox(searchRect);
+		for (uint32_t primitive = 0; primitive < boxes.size(); primitive++)
+		{
+			if (BoxesCollide(searchBox, boxes[primitive]))
+			{
+				onObjectHit(primitive);
+			}
+		}
+	};
+	VerifyAgainstBruteForce(method, queries, verifyQueries, query, bruteForce);
+	return MeasureQueries(queries, SETTINGS.queryCount, query);
+}
+
+/* The scene through two more instantiations of the generic tree: 3D double boxes, where every object is given a random depth,
+ * and 2D integer boxes, where every object is rounded out to whole units
+ */
+void MeasureGenericInstantiations(const std::vector<FloatRect>& queries, uint32_t verifyQueries, std::mt19937& random)
+{
+	uint32_t objectCount = gameObjectBounds.Size();
+	std::uniform_real_distribution<double> front(0.0, 256.0);
+	std::vector<Box<3, double>> boxes3D(objectCount);
+	std::vector<Box<2, int32_t>> integerBoxes(objectCount);
+	for (uint32_t object = 0; object < objectCount; object++)
+	{
+		double z = front(random);
+		boxes3D[object] = { { gameObjectBounds.minX[object], gameObjectBounds.minY[object], z },
+			{ gameObjectBounds.maxX[object], gameObjectBounds.maxY[object], z + 32.0 } };
+		integerBoxes[object] = { { static_cast<int32_t>(std::floor(gameObjectBounds.minX[object])), static_cast<int32_t>(std::floor(gameObjectBounds.minY[object])) },
+			{ static_cast<int32_t>(std::ceil(gameObjectBounds.maxX[object])), static_cast<int32_t>(std::ceil(gameObjectBounds.maxY[object])) } };
+	}
+
+	// 3D queries are slabs of depth cutting through about a quarter of the objects
+	QueryStats stats3D = MeasureGenericBVH("generic 3d double", boxes3D, queries, verifyQueries, [](FloatRect searchRect)
+	{
+		return Box<3, double>{ { searchRect.left, searchRect.top, 112.0 }, { searchRect.left + searchRect.width, searchRect.top + searchRect.height, 144.0 } };
+	});
+	QueryStats integerStats = MeasureGenericBVH("generic 2d int32", integerBoxes, queries, verifyQueries, [](FloatRect searchRect)
+	{
+		return Box<2, int32_t>{ { static_cast<int32_t>(searchRect.left), static_cast<int32_t>(searchRect.top) },
+			{ static_cast<int32_t>(searchRect.left + searchRect.width), static_cast<int32_t>(searchRect.top + searchRect.height) } };
+	});
+	PrintStats("generic 3d double", stats3D);
+	PrintStats("generic 2d int32", integerStats);
+}
+
+void RunScene(Scene scene, uint32_t objectCount)
+{
+	std::mt19937 random(SETTINGS.seed + objectCount);
+	GenerateScene(scene, objectCount, random);
+	std::vector<FloatRect> queries = GenerateQueries(objectCount, SETTINGS.queryCount, random);
+	std::vector<FloatRect> movingQueries = GenerateMovingQueries(queries, SETTINGS.queryCount, random);
+
+	std::printf("\nscene=%s objects=%u\n", SceneName(scene), objectCount);
+	MeasureSceneLoading(objectCount);
+
+	auto queryBVH = [](FloatRect searchRect, auto&& onObjectHit) { QueryBVH(searchRect, onObjectHit); };
+	auto queryBVH4 = [](FloatRect searchRect, auto&& onObjectHit) { QueryBVH4(searchRect, onObjectHit); };
+	auto queryBruteForce = [](FloatRect searchRect, auto&& onObjectHit) { BruteForceQuery(searchRect, onObjectHit); };
+
+	// Segment casts report their closest hit, if any, as the one hit of the query
+	std::vector<FloatRect> segments = GenerateSegments(objectCount, SETTINGS.queryCount, random);
+	auto castSegment = [](FloatRect segment, auto&& onObjectHit)
+	{
+		RayHit hit = CastRay(SegmentAsRay(segment));
+		if (hit.object != NULL_OBJECT)
+		{
+			onObjectHit(hit.object);
+		}
+	};
+	auto castSegmentBruteForce = [](FloatRect segment, auto&& onObjectHit)
+	{
+		RayHit hit = BruteForceCastRay(SegmentAsRay(segment));
+		if (hit.object != NULL_OBJECT)
+		{
+			onObjectHit(hit.object);
+		}
+	};
+	// Verified by the bits of the t each segment first hits at, CastRay and brute force may pick different objects at equal t
+	auto segmentHitT = [](const RayHit& hit, auto&& onHit)
+	{
+		if (hit.object != NULL_OBJECT)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &hit.t, sizeof(bits));
+			onHit(bits);
+		}
+	};
+	auto castSegmentT = [&segmentHitT](FloatRect segment, auto&& onHit) { segmentHitT(CastRay(SegmentAsRay(segment)), onHit); };
+	auto castSegmentBruteForceT = [&segmentHitT](FloatRect segment, auto&& onHit) { segmentHitT(BruteForceCastRay(SegmentAsRay(segment)), onHit); };
+
+	// Nearest object queries search from the corner of each query box, and report every neighbour found as a hit
+	NearestObjects nearest;
+	auto findNearest = [&nearest](FloatRect searchRect, auto&& onObjectHit)
+	{
+		FindNearestObjects(FloatRect(searchRect.left, searchRect.top, 0, 0), SETTINGS.nearestCount, nearest);
+		for (const NearestObject& neighbour : nearest.objects)
+		{
+			onObjectHit(neighbour.object);
+		}
+	};
+	auto findNearestBruteForce = [&nearest](FloatRect searchRect, auto&& onObjectHit)
+	{
+		BruteForceNearestObjects(FloatRect(searchRect.left, searchRect.top, 0, 0), SETTINGS.nearestCount, nearest);
+		for (const NearestObject& neighbour : nearest.objects)
+		{
+			onObjectHit(neighbour.object);
+		}
+	};
+
+	uint32_t bruteForceQueries = static_cast<uint32_t>(std::max<uint64_t>(10, SETTINGS.bruteForceBudget / objectCount));
+	bruteForceQueries = std::min(bruteForceQueries, SETTINGS.queryCount);
+	uint32_t verifyQueries = std::min(bruteForceQueries, 100u);
+
+	// SAH first, so the median build is the one left in place for the BVH4 and batched runs
+	QueryStats sahStats;
+	bool ranSAH = objectCount <= SETTINGS.maxSAHObjects;
+	if (ranSAH)
+	{
+		CreateBVH(BuildMode::SurfaceAreaHeuristic, true, SETTINGS.maxLeafObjects);
+		std::printf("  build sah mt:  %10.2f ms  nodes=%zu\n", bvhBuild_timeInMs, bvh.size());
+		BuiltTree multiThreaded = CopyBuiltTree();
+		CreateBVH(BuildMode::SurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+		std::printf("  build sah:     %10.2f ms  nodes=%zu\n", bvhBuild_timeInMs, bvh.size());
+		VerifySameAsMultiThreaded("bvh sah", multiThreaded);
+		VerifyAgainstBruteForce("bvh sah", queries, verifyQueries, queryBVH);
+		sahStats = MeasureQueries(queries, SETTINGS.queryCount, queryBVH);
+	}
+	else
+	{
+		std::printf("  build sah:     skipped above %u objects\n", SETTINGS.maxSAHObjects);
+	}
+
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, true, SETTINGS.maxLeafObjects);
+	std::printf("  build binned mt: %8.2f ms  nodes=%zu\n", bvhBuild_timeInMs, bvh.size());
+	BuiltTree multiThreaded = CopyBuiltTree();
+	CreateBVH(BuildMode::BinnedSurfaceAreaHeuristic, false, SETTINGS.maxLeafObjects);
+	std::printf("  build binned:  %10.2f ms  nodes=%zu\n", bvhBuild_timeInMs, bvh.size());
+	VerifySameAsMultiThreaded("bvh binned sah", multiThreaded);
+	VerifyAgainstBruteForce("bvh binned sah", queries, verifyQueries, queryBVH);
+	QueryStats binnedStats = MeasureQueries(queries, SETTINGS.queryCount, queryBVH);
+	MeasureCollidingPairs(objectCount);
+	MeasureVisuals();
+
+	// Every moving entity keeps its own context, the cold run descends from the root for each of the same queries
+	std::vector<QueryContext> queryContexts(MOVING_ENTITIES);
+	uint32_t movingQuery = 0;
+	auto queryCoherent = [&queryContexts, &movingQuery](FloatRect searchRect, auto&& onObjectHit)
+	{
+		QueryBVHCoherent(queryContexts[movingQuery++ % MOVING_ENTITIES], searchRect, onObjectHit);
+	};
+	VerifyAgainstBruteForce("bvh coherent", movingQueries, verifyQueries, queryCoherent);
+	QueryStats movingStats = MeasureQueries(movingQueries, SETTINGS.queryCount, queryBVH);
+	queryContexts.assign(MOVING_ENTITIES, QueryContext());
+	movingQuery = 0;
+	QueryStats coherentStats = MeasureQueries(movingQueries, SETTINGS.queryCount, queryCoherent);
+
+	// The generic tree over the same objects, which should match the binned build of bvh
+	GenericBVH<2, float, GameObjectBoundsAccessor> genericBVH;
+	auto t0 = Clock::now();
+	genericBVH.Build(objectCount, SETTINGS.maxLeafObjects);
+	std::printf("  build generic: %10.2f ms  nodes=%zu (2d float, serial)\n", ElapsedMs(t0), genericBVH.nodes.size());
+	auto queryGeneric = [&genericBVH](FloatRect searchRect, auto&& onObjectHit)
+	{
+		genericBVH.Query({ { searchRect.left, searchRect.top }, { searchRect.left + searchRect.width, searchRect.top + searchRect.height } }, onObjectHit);
+	};
+	VerifyAgainstBruteForce("generic bvh", queries, verifyQueries, queryGeneric);
+	QueryStats genericStats = MeasureQueries(queries, SETTINGS.queryCount, queryGeneric);
+	genericBVH.Clear();
+
+	t0 = Clock::now();
+	CreateQuantizedBVH();
+	std::printf("  build quantized: %8.2f ms  %zu MB of nodes, %zu MB before (from binned)\n", ElapsedMs(t0),
+		bvhQuantized.size() * sizeof(QuantizedNode) >> 20, bvh.size() * sizeof(Node) >> 20);
+	auto queryQuantized = [](FloatRect searchRect, auto&& onObjectHit) { QueryQuantizedBVH(searchRect, onObjectHit); };
+	VerifyAgainstBruteForce("bvh quantized", queries, verifyQueries, queryQuantized);
+	QueryStats quantizedStats = MeasureQueries(queries, SETTINGS.queryCount, queryQuantized);
+
+	// The binned tree saved and mapped back, opening only maps the file so the first queries also pay for loading pages
+	const char* bvhFilePath = "bvh_benchmark.bvh";
+	QueryStats mappedStats;
+	MappedBVH mappedBVH;
+	t0 = Clock::now();
+	bool saved = SaveBVH(bvhFilePath);
+	float saveMs = ElapsedMs(t0);
+	t0 = Clock::now();
+	if (saved && mappedBVH.Open(bvhFilePath))
+	{
+		std::printf("  save bvh file: %10.2f ms  open mapped: %.3f ms\n", saveMs, ElapsedMs(t0));
+		auto queryMapped = [&mappedBVH](FloatRect searchRect, auto&& onObjectHit) { QueryMappedBVH(mappedBVH, searchRect, onObjectHit); };
+		mappedStats = MeasureQueries(queries, SETTINGS.queryCount, queryMapped);
+		VerifyAgainstBruteForce("bvh mapped", queries, verifyQueries, queryMapped);
+		mappedBVH.Close();
+	}
+	else
+	{
+		std::printf("  save bvh file: failed to save or map %s\n", bvhFilePath);
+	}
+	std::remove(bvhFilePath);
+
+	VerifyAgainstBruteForce("bvh segment", segments, verifyQueries, castSegmentT, castSegmentBruteForceT);
+	QueryStats segmentStats = MeasureQueries(segments, SETTINGS.queryCount, castSegment);
+	QueryStats bruteForceSegmentStats = MeasureQueries(segments, bruteForceQueries, castSegmentBruteForce);
+
+	VerifyAgainstBruteForce("bvh nearest", queries, verifyQueries, findNearest, findNearestBruteForce);
+	QueryStats nearestStats = MeasureQueries(queries, SETTINGS.queryCount, findNearest);
+	QueryStats bruteForceNearestStats = MeasureQueries(queries, bruteForceQueries, findNearestBruteForce);
+
+	QueryStats snapshotStats = MeasureBackgroundRebuild(queries, verifyQueries, random);
+
+	CreateBVH(BuildMode::LinearMorton, true, SETTINGS.maxLeafObjects);
+	std::printf("  build lbvh mt: %10.2f ms  nodes=%zu\n", bvhBuild_timeInMs, bvh.size());
+	multiThreaded = CopyBuiltTree();
+	CreateBVH(BuildMode::LinearMorton, false, SETTINGS.maxLeafObjects);
+	std::printf("  build lbvh:    %10.2f ms  nodes=%zu\n", bvhBuild_timeInMs, bvh.size());
+	VerifySameAsMultiThreaded("bvh lbvh", multiThreaded);
+	VerifyAgainstBruteForce("bvh lbvh", queries, verifyQueries, queryBVH);
+	QueryStats lbvhStats = MeasureQueries(queries, SETTINGS.queryCount, queryBVH);
+
+	CreateBVH(BuildMode::Median, true, SETTINGS.maxLeafObjects);
+	std::printf("  build median mt: %8.2f ms  nodes=%zu\n", bvhBuild_timeInMs, bvh.size());
+	multiThreaded = CopyBuiltTree();
+	CreateBVH(BuildMode::Median, false, SETTINGS.maxLeafObjects);
+	std::printf("  build median:  %10.2f ms  nodes=%zu\n", bvhBuild_timeInMs, bvh.size());
+	VerifySameAsMultiThreaded("bvh median", multiThreaded);
+
+	auto t1 = Clock::now();
+	CreateBVH4();
+	std::printf("  build bvh4:    %10.2f ms  nodes=%zu (collapse only)\n", ElapsedMs(t1), bvh4.size());
+	std::printf("  bvh memory:    %10.2f MB  (including build scratch)\n", BVHMemoryInBytes() / (1024.0 * 1024.0));
+
+	VerifyAgainstBruteForce("bvh median", queries, verifyQueries, queryBVH);
+	VerifyAgainstBruteForce("bvh4", queries, verifyQueries, queryBVH4);
+
+	PrintStatsHeader();
+	PrintStats("brute force", MeasureQueries(queries, bruteForceQueries, queryBruteForce));
+	if (ranSAH)
+	{
+		PrintStats("bvh sah", sahStats);
+	}
+	PrintStats("bvh binned sah", binnedStats);
+	PrintStats("bvh binned moving", movingStats);
+	PrintStats("bvh binned coherent", coherentStats);
+	PrintStats("bvh mapped binned", mappedStats);
+	PrintStats("bvh snapshot binned", snapshotStats);
+	PrintStats("bvh quantized binned", quantizedStats);
+	PrintStats("generic 2d float", genericStats);
+	PrintStats("bvh lbvh", lbvhStats);
+	PrintStats("bvh median", MeasureQueries(queries, SETTINGS.queryCount, queryBVH));
+	PrintStats("bvh4 median", MeasureQueries(queries, SETTINGS.queryCount, queryBVH4));
+	PrintStats("brute force segment", bruteForceSegmentStats);
+	PrintStats("bvh binned segment", segmentStats);
+	PrintStats("brute force nearest", bruteForceNearestStats);
+	PrintStats("bvh binned nearest", nearestStats);
+
+	// The batch is timed as a whole, so only throughput is reported
+	BatchQueryResults results;
+	QueryBVHBatch(queries.data(), static_cast<uint32_t>(queries.size()), results);
+	t1 = Clock::now();
+	QueryBVHBatch(queries.data(), static_cast<uint32_t>(queries.size()), results);
+	double batchSeconds = ElapsedMs(t1) / 1000.0;
+	std::printf("  %-22s %9zu %10s %10s %10s %10s %14.0f %11.2f\n", "batched median", queries.size(), "-", "-", "-", "-",
+		batchSeconds > 0 ? queries.size() / batchSeconds : 0.0,
+		queries.empty() ? 0.0 : static_cast<double>(results.objects.size()) / queries.size());
+
+	// Reads back the hits of each query in turn, as VerifyAgainstBruteForce runs the queries in order
+	uint32_t batchQuery = 0;
+	auto queryBatched = [&results, &batchQuery](FloatRect, auto&& onObjectHit)
+	{
+		uint32_t query = batchQuery++;
+		for (uint32_t i = results.offsets[query]; i < results.offsets[query + 1]; i++)
+		{
+			onObjectHit(results.objects[i]);
+		}
+	};
+	VerifyAgainstBruteForce("batched median", queries, verifyQueries, queryBatched);
+
+	MeasureRefit(queries, verifyQueries, random);
+	MeasureDynamicTree(queries, verifyQueries, random);
+	MeasureGenericInstantiations(queries, verifyQueries, random);
+	MeasureShapeQueries(queries, verifyQueries);
+}
+
+bool ParseArguments(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (std::strcmp(argv[i], "--min") == 0 && hasValue)
+		{
+			SETTINGS.minObjects = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--max") == 0 && hasValue)
+		{
+			SETTINGS.maxObjects = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--queries") == 0 && hasValue)
+		{
+			SETTINGS.queryCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--scene") == 0 && hasValue)
+		{
+			SETTINGS.scene = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && hasValue)
+		{
+			SETTINGS.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--leaf") == 0 && hasValue)
+		{
+			SETTINGS.maxLeafObjects = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else
+		{
+			std::printf("Usage: %s [--min objects] [--max objects] [--queries count] [--scene uniform|clustered|skewed|all] [--seed value] [--leaf objects]\n", argv[0]);
+			return false;
+		}
+	}
+	return SETTINGS.minObjects > 0 && SETTINGS.queryCount > 0 && SETTINGS.maxLeafObjects > 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (!ParseArguments(argc, argv))
+	{
+		return 1;
+	}
+
+	std::printf("BVH benchmark, %u threads, %u queries per scene, simd=%d\n", threadPool.ThreadCount(), SETTINGS.queryCount, BVH_USE_SSE);
+
+	VerifyRaysAlongEdges();
+
+	const Scene scenes[] = { Scene::Uniform, Scene::Clustered, Scene::SizeSkewed };
+	for (Scene scene : scenes)
+	{
+		if (SETTINGS.scene != "all" && SETTINGS.scene != SceneName(scene))
+		{
+			continue;
+		}
+		for (uint64_t objectCount = SETTINGS.minObjects; objectCount <= SETTINGS.maxObjects; objectCount *= 10)
+		{
+			RunScene(scene, static_cast<uint32_t>(objectCount));
+		}
+	}
+
+	if (verifyFailures > 0)
+	{
+		std::printf("\n%u checks did not match brute force\n", verifyFailures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1101 @@
+#include "BVH.h"
+#include "GenericBVH.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+GameObjectBounds gameObjectBounds;
+std::vector<uint32_t> bvhObjects;
+std::vector<Node> bvh;
+std::vector<uint32_t> objectLeafNodes;
+float bvhBuild_timeInMs = 0.0f;
+uint32_t bvhGeneration = 0;
+
+// Nodes with fewer objects than this are built on the thread that reached them, larger ones split into tasks
+constexpr uint32_t PARALLEL_BUILD_CUTOFF = 4096;
+
+// Set while CreateBVH runs with multiThreaded, so the sorts of large ranges are split into tasks too
+bool buildMultiThreaded = false;
+
+// Nodes with this many objects or fewer become leaves, set by CreateBVH
+uint32_t buildMaxLeafObjects = 2;
+
+/* Bounds the build reads and the tree it writes, only other than gameObjectBounds, bvh, bvhObjects and objectLeafNodes
+ * during CreateBVHFromBounds. The build touches nothing else of the global tree, so a build into other buffers leaves it as it was
+ */
+const GameObjectBounds* buildBounds = &gameObjectBounds;
+std::vector<Node>* buildTree = &bvh;
+std::vector<uint32_t>* buildObjects = &bvhObjects;
+std::vector<uint32_t>* buildLeafNodes = &objectLeafNodes;
+
+/* Held by CreateBVH and CreateBVHFromBounds for the whole build, and by BVHMemoryInBytes and ReleaseBVHMemory.
+ * Builds share the pointers above and every scratch buffer below, so a background rebuild and the game's thread take turns with them
+ */
+std::mutex buildMutex;
+
+// Merge space for SortObjects, the same size as bvhObjects so every range of it has its own matching range here
+std::vector<uint32_t> sortScratch;
+
+/* Sorts a range of object indices, splitting large ranges into tasks when building multi threaded.
+ * Every comparison used here breaks ties on the object index, so the result is the same no matter how the range was split.
+ */
+template <typename Compare>
+void SortObjects(uint32_t* begin, uint32_t* end, Compare compare)
+{
+	if (!buildMultiThreaded || end - begin < PARALLEL_BUILD_CUTOFF)
+	{
+		std::sort(begin, end, compare);
+		return;
+	}
+
+	uint32_t* middle = begin + (end - begin) / 2;
+	TaskGroup group;
+	threadPool.Spawn(group, [=]() { SortObjects(begin, middle, compare); });
+	SortObjects(middle, end, compare);
+	threadPool.Wait(group);
+
+	// Merged through the scratch space rather than with std::inplace_merge, which allocates a buffer every time
+	uint32_t* scratch = sortScratch.data() + (begin - buildObjects->data());
+	std::merge(begin, middle, middle, end, scratch, compare);
+	std::copy(scratch, scratch + (end - begin), begin);
+}
+
+// Puts every object into bvhObjects in index order
+void ResetObjectOrder()
+{
+	std::vector<uint32_t>& objects = *buildObjects;
+	objects.resize(buildBounds->Size());
+	for (uint32_t object = 0; object < objects.size(); object++)
+	{
+		objects[object] = object;
+	}
+}
+
+// The median split only ever cuts a node's range in half, so one sort up front orders every node at once
+void OrganiseGameObjects()
+{
+	ResetObjectOrder();
+	SortObjects(buildObjects->data(), buildObjects->data() + buildObjects->size(), [](uint32_t a, uint32_t b)
+	{
+		return buildBounds->minX[a] < buildBounds->minX[b] || (buildBounds->minX[a] == buildBounds->minX[b] && a < b);
+	});
+}
+
+// Appends a node to the end of the bvh and returns its index
+uint32_t AddNode(uint32_t parentNode, uint32_t firstObject, uint32_t objectCount)
+{
+	std::vector<Node>& nodes = *buildTree;
+	nodes.emplace_back();
+	nodes.back().DefineParentNode(parentNode);
+	nodes.back().DefineGameObjects(firstObject, objectCount);
+	return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void CreateNewNode(uint32_t currentNode)
+{
+	std::vector<Node>& nodes = *buildTree;
+
+	// End node creation if the number of objects in the current node is maxLeafObjects or less
+	if (nodes[currentNode].objectCount <= buildMaxLeafObjects)
+	{
+		// This node is now a leaf node
+		return;
+	}
+
+	// Divide and conqour
+	uint32_t firstObject = nodes[currentNode].firstObject;
+	uint32_t objectCount = nodes[currentNode].objectCount;
+	uint32_t midPoint = objectCount / 2;
+
+	// ChildA is created and fully built first, so it always sits directly after its parent
+	uint32_t childA = AddNode(currentNode, firstObject, midPoint);
+	CreateNewNode(childA);
+
+	uint32_t childB = AddNode(currentNode, firstObject + midPoint, objectCount - midPoint);
+	nodes[currentNode].DefineChildB(childB);
+	CreateNewNode(childB);
+}
+
+/* Surface Area Heuristic ----------------------------------------------------------------------------------------------------------
+ * In 2D the chance of a query touching a box grows with its perimeter, so the expected cost of a split is
+ * perimeter(A) * count(A) + perimeter(B) * count(B). Both axes are swept and the cheapest split position is kept.
+ */
+// Scratch space for the sweep, kept between builds so the SAH build does not allocate per node.
+// Indexed by position within bvhObjects, so nodes being split at the same time never share any of it
+std::vector<float> sahRightCosts;
+
+float HalfPerimeter(float smallestX, float smallestY, float largestX, float largestY)
+{
+	return (largestX - smallestX) + (largestY - smallestY);
+}
+
+// Twice the centre of the object on the given axis, only ever used for ordering
+float Centre(uint32_t object, int axis)
+{
+	return axis == 0 ? buildBounds->minX[object] + buildBounds->maxX[object]
+		: buildBounds->minY[object] + buildBounds->maxY[object];
+}
+
+void SortObjectsOnAxis(uint32_t firstObject, uint32_t objectCount, int axis)
+{
+	uint32_t* begin = buildObjects->data() + firstObject;
+	SortObjects(begin, begin + objectCount, [axis](uint32_t a, uint32_t b)
+	{
+		float centreA = Centre(a, axis);
+		float centreB = Centre(b, axis);
+		return centreA < centreB || (centreA == centreB && a < b);
+	});
+}
+
+// Sorts the range on the given axis and returns the cheapest split cost, writing the size of the left side to splitCount
+float SweepSAHSplit(uint32_t firstObject, uint32_t objectCount, int axis, uint32_t& splitCount)
+{
+	SortObjectsOnAxis(firstObject, objectCount, axis);
+	const uint32_t* objects = buildObjects->data();
+
+	// Sweep from the right, storing the cost of every possible right side
+	float smallestX = FLT_MAX, smallestY = FLT_MAX, largestX = -FLT_MAX, largestY = -FLT_MAX;
+	for (uint32_t i = objectCount; i-- > 1;)
+	{
+		uint32_t object = objects[firstObject + i];
+		smallestX = std::min(buildBounds->minX[object], smallestX);
+		smallestY = std::min(buildBounds->minY[object], smallestY);
+		largestX = std::max(buildBounds->maxX[object], largestX);
+		largestY = std::max(buildBounds->maxY[object], largestY);
+		sahRightCosts[firstObject + i] = HalfPerimeter(smallestX, smallestY, largestX, largestY) * (objectCount - i);
+	}
+
+	// Sweep from the left, the right side starts at object i
+	float bestCost = FLT_MAX;
+	smallestX = FLT_MAX, smallestY = FLT_MAX, largestX = -FLT_MAX, largestY = -FLT_MAX;
+	for (uint32_t i = 1; i < objectCount; i++)
+	{
+		uint32_t object = objects[firstObject + i - 1];
+		smallestX = std::min(buildBounds->minX[object], smallestX);
+		smallestY = std::min(buildBounds->minY[object], smallestY);
+		largestX = std::max(buildBounds->maxX[object], largestX);
+		largestY = std::max(buildBounds->maxY[object], largestY);
+
+		float cost = HalfPerimeter(smallestX, smallestY, largestX, largestY) * i + sahRightCosts[firstObject + i];
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			splitCount = i;
+		}
+	}
+	return bestCost;
+}
+
+// Reorders the range for the cheapest split and returns the number of objects going to childA
+uint32_t FindSAHSplit(uint32_t firstObject, uint32_t objectCount)
+{
+	uint32_t splitX = objectCount / 2;
+	uint32_t splitY = objectCount / 2;
+	float costX = SweepSAHSplit(firstObject, objectCount, 0, splitX);
+	float costY = SweepSAHSplit(firstObject, objectCount, 1, splitY);
+
+	// The range is left sorted on y, so only re-sort when x gave the cheaper split
+	uint32_t splitCount = splitY;
+	if (costX < costY)
+	{
+		SortObjectsOnAxis(firstObject, objectCount, 0);
+		splitCount = splitX;
+	}
+	return splitCount;
+}
+
+void CreateNewNodeSAH(uint32_t currentNode)
+{
+	std::vector<Node>& nodes = *buildTree;
+
+	// End node creation if the number of objects in the current node is maxLeafObjects or less
+	if (nodes[currentNode].objectCount <= buildMaxLeafObjects)
+	{
+		return;
+	}
+
+	uint32_t firstObject = nodes[currentNode].firstObject;
+	uint32_t objectCount = nodes[currentNode].objectCount;
+	uint32_t splitCount = FindSAHSplit(firstObject, objectCount);
+
+	uint32_t childA = AddNode(currentNode, firstObject, splitCount);
+	CreateNewNodeSAH(childA);
+
+	uint32_t childB = AddNode(currentNode, firstObject + splitCount, objectCount - splitCount);
+	nodes[currentNode].DefineChildB(childB);
+	CreateNewNodeSAH(childB);
+}
+
+/* Linear BVH -----------------------------------------------------------------------------------------------------------------------
+ * Objects are ordered along a Morton curve through their centres, which keeps objects that are close in 2D close in the array.
+ * Every key holds the 32 bit Morton code in its upper half and the object index in its lower half, so sorting keys sorts objects.
+ * Each node is then split where the highest bit that differs between its first and last code flips.
+ * Nothing is compared against anything else, so both the sort and the splits are O(n).
+ */
+std::vector<uint64_t> mortonKeys;
+// Scratch space for the radix sort and the centre bounds, kept between builds
+std::vector<uint64_t> mortonScratch;
+std::vector<uint32_t> radixHistograms;
+std::vector<FloatRect> mortonBlockBounds;
+
+// Spreads the lower 16 bits out to the even bits
+uint32_t SpreadBits(uint32_t x)
+{
+	x &= 0x0000FFFF;
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+uint32_t MortonCode(float x, float y)
+{
+	uint32_t quantisedX = static_cast<uint32_t>(std::min(std::max(x * 65535.0f, 0.0f), 65535.0f));
+	uint32_t quantisedY = static_cast<uint32_t>(std::min(std::max(y * 65535.0f, 0.0f), 65535.0f));
+	return (SpreadBits(quantisedY) << 1) | SpreadBits(quantisedX);
+}
+
+// Splits [0, count) into evenly sized blocks, one per job
+uint32_t BuildBlockCount(uint32_t count)
+{
+	return buildMultiThreaded ? std::min(threadPool.ThreadCount() * 4, std::max(1u, count / PARALLEL_BUILD_CUTOFF)) : 1;
+}
+
+uint32_t BlockStart(uint32_t block, uint32_t blockCount, uint32_t count)
+{
+	return static_cast<uint32_t>(static_cast<uint64_t>(count) * block / blockCount);
+}
+
+// Stable LSD radix sort on the Morton half of the keys, the object index half is already in order
+void RadixSortMortonKeys()
+{
+	uint32_t count = static_cast<uint32_t>(mortonKeys.size());
+	uint32_t blockCount = BuildBlockCount(count);
+	mortonScratch.resize(count);
+	radixHistograms.resize(blockCount * 256);
+
+	for (int shift = 32; shift < 64; shift += 8)
+	{
+		// Count the digits within every block
+		threadPool.Run(blockCount, [&](uint32_t block)
+		{
+			uint32_t* histogram = radixHistograms.data() + block * 256;
+			std::fill(histogram, histogram + 256, 0);
+			for (uint32_t i = BlockStart(block, blockCount, count); i < BlockStart(block + 1, blockCount, count); i++)
+			{
+				histogram[(mortonKeys[i] >> shift) & 0xFF]++;
+			}
+		});
+
+		// Where every block writes each digit, digits first so the sort stays stable
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < 256; digit++)
+		{
+			for (uint32_t block = 0; block < blockCount; block++)
+			{
+				uint32_t digitCount = radixHistograms[block * 256 + digit];
+				radixHistograms[block * 256 + digit] = offset;
+				offset += digitCount;
+			}
+		}
+
+		threadPool.Run(blockCount, [&](uint32_t block)
+		{
+			uint32_t* histogram = radixHistograms.data() + block * 256;
+			for (uint32_t i = BlockStart(block, blockCount, count); i < BlockStart(block + 1, blockCount, count); i++)
+			{
+				mortonScratch[histogram[(mortonKeys[i] >> shift) & 0xFF]++] = mortonKeys[i];
+			}
+		});
+		mortonKeys.swap(mortonScratch);
+	}
+}
+
+// Orders bvhObjects along the Morton curve, the linear build's replacement for OrganiseGameObjects
+void OrganiseGameObjectsMorton()
+{
+	uint32_t count = buildBounds->Size();
+	uint32_t blockCount = BuildBlockCount(count);
+	std::vector<uint32_t>& objects = *buildObjects;
+	objects.resize(count);
+	mortonKeys.resize(count);
+
+	// Bounds of all the centres, so the codes use the full 16 bits on both axes
+	mortonBlockBounds.resize(blockCount);
+	threadPool.Run(blockCount, [&](uint32_t block)
+	{
+		float smallestX = FLT_MAX, smallestY = FLT_MAX, largestX = -FLT_MAX, largestY = -FLT_MAX;
+		for (uint32_t object = BlockStart(block, blockCount, count); object < BlockStart(block + 1, blockCount, count); object++)
+		{
+			float centreX = (buildBounds->minX[object] + buildBounds->maxX[object]) * 0.5f;
+			float centreY = (buildBounds->minY[object] + buildBounds->maxY[object]) * 0.5f;
+			smallestX = std::min(centreX, smallestX);
+			smallestY = std::min(centreY, smallestY);
+			largestX = std::max(centreX, largestX);
+			largestY = std::max(centreY, largestY);
+		}
+		mortonBlockBounds[block] = FloatRect(smallestX, smallestY, largestX - smallestX, largestY - smallestY);
+	});
+	FloatRect centreBounds = mortonBlockBounds[0];
+	for (const FloatRect& bounds : mortonBlockBounds)
+	{
+		centreBounds = UnionRect(centreBounds, bounds);
+	}
+
+	float scaleX = centreBounds.width > 0 ? 1.0f / centreBounds.width : 0.0f;
+	float scaleY = centreBounds.height > 0 ? 1.0f / centreBounds.height : 0.0f;
+	threadPool.Run(blockCount, [&](uint32_t block)
+	{
+		for (uint32_t object = BlockStart(block, blockCount, count); object < BlockStart(block + 1, blockCount, count); object++)
+		{
+			float centreX = (buildBounds->minX[object] + buildBounds->maxX[object]) * 0.5f;
+			float centreY = (buildBounds->minY[object] + buildBounds->maxY[object]) * 0.5f;
+			uint32_t code = MortonCode((centreX - centreBounds.left) * scaleX, (centreY - centreBounds.top) * scaleY);
+			mortonKeys[object] = (static_cast<uint64_t>(code) << 32) | object;
+		}
+	});
+
+	RadixSortMortonKeys();
+
+	threadPool.Run(blockCount, [&](uint32_t block)
+	{
+		for (uint32_t i = BlockStart(block, blockCount, count); i < BlockStart(block + 1, blockCount, count); i++)
+		{
+			objects[i] = static_cast<uint32_t>(mortonKeys[i]);
+		}
+	});
+}
+
+// Returns the number of objects going to childA, split where the highest differing bit of the range's Morton codes flips
+uint32_t FindMortonSplit(uint32_t firstObject, uint32_t objectCount)
+{
+	uint32_t firstCode = static_cast<uint32_t>(mortonKeys[firstObject] >> 32);
+	uint32_t lastCode = static_cast<uint32_t>(mortonKeys[firstObject + objectCount - 1] >> 32);
+	if (firstCode == lastCode)
+	{
+		// Objects sharing a code are split down the middle
+		return objectCount / 2;
+	}
+
+	uint32_t differingBit = 31;
+	while (!(((firstCode ^ lastCode) >> differingBit) & 1))
+	{
+		differingBit--;
+	}
+
+	// The range is sorted, so every object before the split has the bit clear and every object after has it set
+	auto first = mortonKeys.begin() + firstObject;
+	auto split = std::partition_point(first, first + objectCount,
+		[differingBit](uint64_t key) { return !((key >> (32 + differingBit)) & 1); });
+	return static_cast<uint32_t>(split - first);
+}
+
+/* Binned Surface Area Heuristic ----------------------------------------------------------------------------------------------------
+ * The binning, cost sweep and partition are shared with GenericBVH, see Binned SAH in GenericBVH.h.
+ * Large nodes accumulate their bins as parallel tasks, nodes small enough that sorting is cheap use the exact sweep above.
+ */
+constexpr uint32_t SAH_SWEEP_CUTOFF = 16;
+
+using ObjectBox = Box<2, float>;
+using ObjectBin = SAHBin<2, float, float>;
+using ObjectBinning = SAHBinning<2, float>;
+
+/* Copy of every object's bounds in bvhObjects order, partitioned alongside it so binning reads memory in order.
+ * The exact sweep only reorders bvhObjects, which is fine as nodes below SAH_SWEEP_CUTOFF never bin again
+ */
+std::vector<ObjectBox> binnedBounds;
+
+void CopyBinnedBounds()
+{
+	const std::vector<uint32_t>& objects = *buildObjects;
+	uint32_t count = static_cast<uint32_t>(objects.size());
+	uint32_t blockCount = BuildBlockCount(count);
+	binnedBounds.resize(count);
+	threadPool.Run(blockCount, [&](uint32_t block)
+	{
+		for (uint32_t i = BlockStart(block, blockCount, count); i < BlockStart(block + 1, blockCount, count); i++)
+		{
+			uint32_t object = objects[i];
+			binnedBounds[i] = { { buildBounds->minX[object], buildBounds->minY[object] },
+				{ buildBounds->maxX[object], buildBounds->maxY[object] } };
+		}
+	});
+}
+
+// Smallest and largest centre of a range on both axes
+void AccumulateCentreBounds(uint32_t firstObject, uint32_t objectCount, float (&centreMin)[2], float (&centreMax)[2])
+{
+	if (!buildMultiThreaded || objectCount < PARALLEL_BUILD_CUTOFF)
+	{
+		for (uint32_t i = firstObject; i < firstObject + objectCount; i++)
+		{
+			const ObjectBox& box = binnedBounds[i];
+			for (int axis = 0; axis < 2; axis++)
+			{
+				centreMin[axis] = std::min(BoxCentre<float>(box, axis), centreMin[axis]);
+				centreMax[axis] = std::max(BoxCentre<float>(box, axis), centreMax[axis]);
+			}
+		}
+		return;
+	}
+
+	uint32_t half = objectCount / 2;
+	float otherMin[2] = { FLT_MAX, FLT_MAX };
+	float otherMax[2] = { -FLT_MAX, -FLT_MAX };
+	TaskGroup group;
+	threadPool.Spawn(group, [&]() { AccumulateCentreBounds(firstObject, half, otherMin, otherMax); });
+	AccumulateCentreBounds(firstObject + half, objectCount - half, centreMin, centreMax);
+	threadPool.Wait(group);
+	for (int axis = 0; axis < 2; axis++)
+	{
+		centreMin[axis] = std::min(otherMin[axis], centreMin[axis]);
+		centreMax[axis] = std::max(otherMax[axis], centreMax[axis]);
+	}
+}
+
+// Drops every object of the range into its bin on both axes, bins are indexed [axis][bin]
+void AccumulateBins(const ObjectBinning& binning, uint32_t firstObject, uint32_t objectCount, ObjectBin (&bins)[2][MAX_SAH_BINS])
+{
+	if (!buildMultiThreaded || objectCount < PARALLEL_BUILD_CUTOFF)
+	{
+		for (uint32_t i = firstObject; i < firstObject + objectCount; i++)
+		{
+			const ObjectBox& box = binnedBounds[i];
+			bins[0][binning.BinIndex(box, 0)].Grow(box);
+			bins[1][binning.BinIndex(box, 1)].Grow(box);
+		}
+		return;
+	}
+
+	// Min and max do not depend on order, so the merged bins are the same however the range was split
+	uint32_t half = objectCount / 2;
+	ObjectBin otherBins[2][MAX_SAH_BINS];
+	TaskGroup group;
+	threadPool.Spawn(group, [&]() { AccumulateBins(binning, firstObject, half, otherBins); });
+	AccumulateBins(binning, firstObject + half, objectCount - half, bins);
+	threadPool.Wait(group);
+	for (int axis = 0; axis < 2; axis++)
+	{
+		for (uint32_t bin = 0; bin < binning.binCount; bin++)
+		{
+			bins[axis][bin].Grow(otherBins[axis][bin]);
+		}
+	}
+}
+
+// Partitions the range on the cheapest plane between bins and returns the number of objects going to childA
+uint32_t FindBinnedSAHSplit(uint32_t firstObject, uint32_t objectCount)
+{
+	if (objectCount <= SAH_SWEEP_CUTOFF)
+	{
+		return FindSAHSplit(firstObject, objectCount);
+	}
+
+	float centreMin[2] = { FLT_MAX, FLT_MAX };
+	float centreMax[2] = { -FLT_MAX, -FLT_MAX };
+	AccumulateCentreBounds(firstObject, objectCount, centreMin, centreMax);
+
+	ObjectBinning binning(centreMin, centreMax, SAHBinCount(objectCount));
+	ObjectBin bins[2][MAX_SAH_BINS];
+	AccumulateBins(binning, firstObject, objectCount, bins);
+
+	SAHPlane plane = FindCheapestSAHPlane(bins, binning.binCount, objectCount);
+	// Every centre fell into the same bin, so no plane separates them
+	if (plane.axis == -1)
+	{
+		return objectCount / 2;
+	}
+	// bvhObjects and binnedBounds are partitioned together
+	return PartitionOnSAHPlane(binning, plane, buildObjects->data() + firstObject, binnedBounds.data() + firstObject, objectCount);
+}
+
+// Bounds of a range of a tree's object indices
+FloatRect ObjectRangeBounds(const GameObjectBounds& bounds, const std::vector<uint32_t>& objects, uint32_t firstObject, uint32_t objectCount)
+{
+	float smallestX = FLT_MAX, smallestY = FLT_MAX, largestX = -FLT_MAX, largestY = -FLT_MAX;
+	for (uint32_t j = firstObject; j < firstObject + objectCount; j++)
+	{
+		uint32_t object = objects[j];
+		smallestX = std::min(bounds.minX[object], smallestX);
+		smallestY = std::min(bounds.minY[object], smallestY);
+		largestX = std::max(bounds.maxX[object], largestX);
+		largestY = std::max(bounds.maxY[object], largestY);
+	}
+	return FloatRect(smallestX, smallestY, largestX - smallestX, largestY - smallestY);
+}
+
+// The tree is passed in as the build and RefitBVH can be working on different trees, see buildTree
+bool CalculateBoundsOfNode(std::vector<Node>& nodes, const std::vector<uint32_t>& objects, const GameObjectBounds& bounds, uint32_t nodeIndex)
+{
+	Node& currentNode = nodes[nodeIndex];
+	FloatRect box = currentNode.IsLeaf()
+		? ObjectRangeBounds(bounds, objects, currentNode.firstObject, currentNode.objectCount)
+		: UnionRect(nodes[nodeIndex + 1].boundingBox, nodes[currentNode.childB].boundingBox);
+
+	const FloatRect& oldBox = currentNode.boundingBox;
+	if (oldBox.left == box.left && oldBox.top == box.top && oldBox.width == box.width && oldBox.height == box.height)
+	{
+		return false;
+	}
+	currentNode.DefineBounds(box.left, box.top, box.width, box.height);
+	return true;
+}
+
+bool CalculateBoundsOfNode(uint32_t nodeIndex)
+{
+	return CalculateBoundsOfNode(bvh, bvhObjects, gameObjectBounds, nodeIndex);
+}
+
+void CalculateNodeBounds()
+{
+	std::vector<Node>& nodes = *buildTree;
+	const std::vector<uint32_t>& objects = *buildObjects;
+	std::vector<uint32_t>& leafNodes = *buildLeafNodes;
+
+	// Children always come after their parent, so walking backwards finishes both children before the parent
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		const Node& currentNode = nodes[i];
+		if (currentNode.IsLeaf())
+		{
+			for (uint32_t j = currentNode.firstObject; j < currentNode.firstObject + currentNode.objectCount; j++)
+			{
+				leafNodes[objects[j]] = static_cast<uint32_t>(i);
+			}
+		}
+		CalculateBoundsOfNode(nodes, objects, *buildBounds, static_cast<uint32_t>(i));
+	}
+}
+
+/* Two pass build -------------------------------------------------------------------------------------------------------------------
+ * childB can only be placed once the size of childA's subtree is known, so the multi threaded build runs in two passes.
+ * The linear and binned builds always use this path, single threaded when multiThreaded is not set.
+ * 1. Split: nodes are split exactly as in the serial build, with the children of large nodes built as separate tasks.
+ *    Every node goes into buildNodes in whatever order the tasks reach it, along with its bounds and subtree size.
+ * 2. Place: the tree is walked again, copying every node to its depth first position within bvh.
+ * The result is identical to the serial build.
+ */
+struct BuildNode {
+	FloatRect boundingBox;
+	uint32_t firstObject = 0;
+	uint32_t objectCount = 0;
+	uint32_t childA = NULL_NODE;
+	uint32_t childB = NULL_NODE;
+	uint32_t subtreeNodes = 1;
+};
+
+std::vector<BuildNode> buildNodes;
+std::atomic<uint32_t> buildNodeCount{ 0 };
+
+uint32_t AddBuildNode(uint32_t firstObject, uint32_t objectCount)
+{
+	uint32_t nodeIndex = buildNodeCount++;
+	buildNodes[nodeIndex] = BuildNode();
+	buildNodes[nodeIndex].firstObject = firstObject;
+	buildNodes[nodeIndex].objectCount = objectCount;
+	return nodeIndex;
+}
+
+// Runs both calls, as two tasks if the node is large enough
+template <typename TaskA, typename TaskB>
+void RunChildTasks(uint32_t objectCount, TaskA&& taskA, TaskB&& taskB)
+{
+	if (!buildMultiThreaded || objectCount < PARALLEL_BUILD_CUTOFF)
+	{
+		taskA();
+		taskB();
+		return;
+	}
+	TaskGroup group;
+	threadPool.Spawn(group, taskA);
+	taskB();
+	threadPool.Wait(group);
+}
+
+void SplitBuildNode(uint32_t nodeIndex, BuildMode buildMode)
+{
+	// buildNodes is sized up front, so this reference stays valid while other tasks add nodes
+	BuildNode& node = buildNodes[nodeIndex];
+	if (node.objectCount <= buildMaxLeafObjects)
+	{
+		node.boundingBox = ObjectRangeBounds(*buildBounds, *buildObjects, node.firstObject, node.objectCount);
+		return;
+	}
+
+	uint32_t splitCount = node.objectCount / 2;
+	if (buildMode == BuildMode::SurfaceAreaHeuristic)
+	{
+		splitCount = FindSAHSplit(node.firstObject, node.objectCount);
+	}
+	else if (buildMode == BuildMode::BinnedSurfaceAreaHeuristic)
+	{
+		splitCount = FindBinnedSAHSplit(node.firstObject, node.objectCount);
+	}
+	else if (buildMode == BuildMode::LinearMorton)
+	{
+		splitCount = FindMortonSplit(node.firstObject, node.objectCount);
+	}
+	node.childA = AddBuildNode(node.firstObject, splitCount);
+	node.childB = AddBuildNode(node.firstObject + splitCount, node.objectCount - splitCount);
+
+	uint32_t childA = node.childA;
+	uint32_t childB = node.childB;
+	RunChildTasks(node.objectCount,
+		[childA, buildMode]() { SplitBuildNode(childA, buildMode); },
+		[childB, buildMode]() { SplitBuildNode(childB, buildMode); });
+
+	node.boundingBox = UnionRect(buildNodes[childA].boundingBox, buildNodes[childB].boundingBox);
+	node.subtreeNodes = 1 + buildNodes[childA].subtreeNodes + buildNodes[childB].subtreeNodes;
+}
+
+void PlaceBuildNode(uint32_t buildNodeIndex, uint32_t nodeIndex, uint32_t parentNode)
+{
+	const BuildNode& source = buildNodes[buildNodeIndex];
+	Node& node = (*buildTree)[nodeIndex];
+	node = Node();
+	node.DefineParentNode(parentNode);
+	node.DefineGameObjects(source.firstObject, source.objectCount);
+	node.DefineBounds(source.boundingBox.left, source.boundingBox.top, source.boundingBox.width, source.boundingBox.height);
+
+	if (source.childA == NULL_NODE)
+	{
+		for (uint32_t j = source.firstObject; j < source.firstObject + source.objectCount; j++)
+		{
+			(*buildLeafNodes)[(*buildObjects)[j]] = nodeIndex;
+		}
+		return;
+	}
+
+	uint32_t childB = nodeIndex + 1 + buildNodes[source.childA].subtreeNodes;
+	node.DefineChildB(childB);
+	RunChildTasks(source.objectCount,
+		[&source, nodeIndex]() { PlaceBuildNode(source.childA, nodeIndex + 1, nodeIndex); },
+		[&source, nodeIndex, childB]() { PlaceBuildNode(source.childB, childB, nodeIndex); });
+}
+
+void CreateBVHInTwoPasses(BuildMode buildMode)
+{
+	buildNodes.resize(buildObjects->size() * 2 - 1);
+	buildNodeCount = 0;
+	if (buildMode == BuildMode::SurfaceAreaHeuristic || buildMode == BuildMode::BinnedSurfaceAreaHeuristic)
+	{
+		sahRightCosts.resize(buildObjects->size());
+	}
+
+	uint32_t root = AddBuildNode(0, static_cast<uint32_t>(buildObjects->size()));
+	SplitBuildNode(root, buildMode);
+
+	buildTree->resize(buildNodes[root].subtreeNodes);
+	buildLeafNodes->resize(buildObjects->size());
+	PlaceBuildNode(root, 0, NULL_NODE);
+}
+
+// Builds buildTree, buildObjects and buildLeafNodes from buildBounds, CreateBVH and CreateBVHFromBounds point them at the tree to build
+void BuildTree(BuildMode buildMode, bool multiThreaded, uint32_t maxLeafObjects)
+{
+	/* Steps to create a BVH
+	 * 1. Organise the object indices in bvhObjects from smallest x to largest x, every node covers a range of it - done
+	 * 2. Create a master node which covers the whole range of gameObjects - done
+	 * 3. Start recursion by passing in the master node
+	 * 4. Create childA directly after the current node and recurse into it - done
+	 * 5. Create childB once childA's subtree is finished and recurse into it - done
+	 * 6. Find the midpoint of the current node's range - done
+	 * 7. Left side of midpoint goes to childA, while right of midpoint goes to childB - done
+	 * 8. Repeat steps 4 to 8 using recursion until the number of gameObjects in that node is maxLeafObjects or less - done
+	 * 9. Calculate the bounds of all nodes, from the last node back to the master node
+	 * With BuildMode::SurfaceAreaHeuristic, step 1 is skipped and steps 6 and 7 instead sort each node on the axis with the cheapest split
+	 * With BuildMode::BinnedSurfaceAreaHeuristic, step 1 is skipped and steps 6 and 7 partition each node on the cheapest bin plane
+	 * With BuildMode::LinearMorton, step 1 sorts along a Morton curve and steps 6 and 7 split on the highest differing bit
+	 * With multiThreaded, BuildMode::BinnedSurfaceAreaHeuristic or BuildMode::LinearMorton,
+	 * steps 3 to 9 are done by CreateBVHInTwoPasses instead
+	 */
+	buildMultiThreaded = multiThreaded && threadPool.ThreadCount() > 1;
+	buildMaxLeafObjects = std::max(maxLeafObjects, 1u);
+	if (buildMultiThreaded)
+	{
+		sortScratch.resize(buildBounds->Size());
+	}
+	if (buildMode == BuildMode::Median)
+	{
+		OrganiseGameObjects();
+	}
+	else if (buildMode == BuildMode::LinearMorton)
+	{
+		OrganiseGameObjectsMorton();
+	}
+	else
+	{
+		// Both SAH builds order each node's range as they split it, so there is nothing to gain from sorting up front
+		ResetObjectOrder();
+		if (buildMode == BuildMode::BinnedSurfaceAreaHeuristic)
+		{
+			CopyBinnedBounds();
+		}
+	}
+
+	// Clearing keeps the capacity of the previous build, a binary tree never needs more than 2n - 1 nodes
+	buildTree->clear();
+	if (buildObjects->empty())
+	{
+		buildMultiThreaded = false;
+		return;
+	}
+	buildTree->reserve(buildObjects->size() * 2 - 1);
+
+	if (buildMultiThreaded || buildMode == BuildMode::BinnedSurfaceAreaHeuristic || buildMode == BuildMode::LinearMorton)
+	{
+		CreateBVHInTwoPasses(buildMode);
+		buildMultiThreaded = false;
+		return;
+	}
+
+	// Create master node
+	uint32_t masterNode = AddNode(NULL_NODE, 0, static_cast<uint32_t>(buildObjects->size()));
+
+	// Start creating bvh
+	if (buildMode == BuildMode::SurfaceAreaHeuristic)
+	{
+		sahRightCosts.resize(buildObjects->size());
+		CreateNewNodeSAH(masterNode);
+	}
+	else
+	{
+		CreateNewNode(masterNode);
+	}
+
+	// Calculate the bounds of all the nodes
+	buildLeafNodes->resize(buildObjects->size());
+	CalculateNodeBounds();
+}
+
+void CreateBVH(BuildMode buildMode, bool multiThreaded, uint32_t maxLeafObjects)
+{
+	std::lock_guard<std::mutex> lock(buildMutex);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	bvhGeneration++;
+	BuildTree(buildMode, multiThreaded, maxLeafObjects);
+
+	auto t2 = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<float, std::milli> time = t2 - t1;
+	bvhBuild_timeInMs = time.count();
+}
+
+float CreateBVHFromBounds(const GameObjectBounds& bounds, std::vector<Node>& nodes, std::vector<uint32_t>& objects, std::vector<uint32_t>& leafNodes,
+	BuildMode buildMode, bool multiThreaded, uint32_t maxLeafObjects)
+{
+	std::lock_guard<std::mutex> lock(buildMutex);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	buildBounds = &bounds;
+	buildTree = &nodes;
+	buildObjects = &objects;
+	buildLeafNodes = &leafNodes;
+	BuildTree(buildMode, multiThreaded, maxLeafObjects);
+	buildBounds = &gameObjectBounds;
+	buildTree = &bvh;
+	buildObjects = &bvhObjects;
+	buildLeafNodes = &objectLeafNodes;
+
+	auto t2 = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<float, std::milli> time = t2 - t1;
+	return time.count();
+}
+
+// Refitting -----------------------------------------------------------------------------------------------------------------------
+
+void RefitBVH(const std::vector<uint32_t>& movedObjects)
+{
+	bvhGeneration++;
+	for (uint32_t object : movedObjects)
+	{
+		// Walk up from the leaf, a node whose bounds did not change leaves everything above it unchanged too
+		uint32_t currentNode = objectLeafNodes[object];
+		while (currentNode != NULL_NODE && CalculateBoundsOfNode(currentNode))
+		{
+			currentNode = bvh[currentNode].previousNode;
+		}
+	}
+}
+
+// 4-wide BVH -----------------------------------------------------------------------------------------------------------------------
+
+std::vector<Node4> bvh4;
+
+// Collapses the binary node at binaryNode and its descendants into bvh4, returns the new node's index
+uint32_t CollapseNode(uint32_t binaryNode)
+{
+	uint32_t node4 = static_cast<uint32_t>(bvh4.size());
+	bvh4.emplace_back();
+
+	// Start from the two children and keep opening the largest inner child until there are four
+	uint32_t lanes[4];
+	int laneCount = 0;
+	if (bvh[binaryNode].IsLeaf())
+	{
+		lanes[laneCount++] = binaryNode;
+	}
+	else
+	{
+		lanes[laneCount++] = binaryNode + 1;
+		lanes[laneCount++] = bvh[binaryNode].childB;
+	}
+
+	while (laneCount < 4)
+	{
+		int largest = -1;
+		float largestPerimeter = -1.0f;
+		for (int i = 0; i < laneCount; i++)
+		{
+			const Node& node = bvh[lanes[i]];
+			float perimeter = node.boundingBox.width + node.boundingBox.height;
+			if (!node.IsLeaf() && perimeter > largestPerimeter)
+			{
+				largest = i;
+				largestPerimeter = perimeter;
+			}
+		}
+		if (largest == -1)
+		{
+			break;
+		}
+		uint32_t opened = lanes[largest];
+		lanes[largest] = opened + 1;
+		lanes[laneCount++] = bvh[opened].childB;
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		Node4& node = bvh4[node4];
+		if (i >= laneCount)
+		{
+			node.minX[i] = FLT_MAX;
+			node.minY[i] = FLT_MAX;
+			node.maxX[i] = -FLT_MAX;
+			node.maxY[i] = -FLT_MAX;
+			node.child[i] = 0;
+			node.objectCount[i] = 0;
+			continue;
+		}
+
+		const Node& child = bvh[lanes[i]];
+		node.minX[i] = child.boundingBox.left;
+		node.minY[i] = child.boundingBox.top;
+		node.maxX[i] = child.boundingBox.left + child.boundingBox.width;
+		node.maxY[i] = child.boundingBox.top + child.boundingBox.height;
+		if (child.IsLeaf())
+		{
+			node.child[i] = child.firstObject;
+			node.objectCount[i] = child.objectCount;
+		}
+		else
+		{
+			// bvh4 may reallocate while collapsing, so the node is looked up again afterwards
+			uint32_t collapsed = CollapseNode(lanes[i]);
+			bvh4[node4].child[i] = collapsed;
+			bvh4[node4].objectCount[i] = 0;
+		}
+	}
+	return node4;
+}
+
+void CreateBVH4()
+{
+	bvh4.clear();
+	if (bvh.empty())
+	{
+		return;
+	}
+	// Every Node4 holds at least two of the binary nodes, so this is an upper bound
+	bvh4.reserve(bvh.size() / 2 + 1);
+	CollapseNode(0);
+}
+
+// Quantized BVH --------------------------------------------------------------------------------------------------------------------
+
+std::vector<QuantizedNode> bvhQuantized;
+QuantizedBounds quantizedRootBounds;
+
+// Decoded bounds of the parents whose childB has not been reached yet, as of the node being quantized
+std::vector<QuantizedBounds> quantizedParentStack;
+
+// Most steps up from parentMin that still decode to at or below value
+uint16_t QuantizeMin(float value, float parentMin, float stepSize)
+{
+	if (!(stepSize > 0.0f))
+	{
+		return 0;
+	}
+	// Truncating rounds down here, anything below 0 is clamped anyway
+	float steps = (value - parentMin) / stepSize;
+	uint32_t quantized = steps <= 0.0f ? 0 : steps >= QUANTIZED_STEPS ? QUANTIZED_STEPS : static_cast<uint32_t>(steps);
+	// The division can round either way, step back until the decoded value really is outside
+	while (quantized > 0 && DequantizeMin(static_cast<uint16_t>(quantized), parentMin, stepSize) > value)
+	{
+		quantized--;
+	}
+	return static_cast<uint16_t>(quantized);
+}
+
+// Fewest steps down from parentMax that still decode to at or above value
+uint16_t QuantizeMax(float value, float parentMax, float stepSize)
+{
+	if (!(stepSize > 0.0f))
+	{
+		return QUANTIZED_STEPS;
+	}
+	float steps = (parentMax - value) / stepSize;
+	uint32_t quantized = QUANTIZED_STEPS - (steps <= 0.0f ? 0 : steps >= QUANTIZED_STEPS ? QUANTIZED_STEPS : static_cast<uint32_t>(steps));
+	while (quantized < QUANTIZED_STEPS && DequantizeMax(static_cast<uint16_t>(quantized), parentMax, stepSize) < value)
+	{
+		quantized++;
+	}
+	return static_cast<uint16_t>(quantized);
+}
+
+void CreateQuantizedBVH()
+{
+	bvhQuantized.clear();
+	// An empty scene is a single leaf without objects, which the quantized layout cannot tell from an inner node
+	if (bvh.empty() || (bvh[0].IsLeaf() && bvh[0].objectCount == 0))
+	{
+		return;
+	}
+
+	bvhQuantized.resize(bvh.size());
+	quantizedParentStack.clear();
+	const FloatRect& rootBox = bvh[0].boundingBox;
+	quantizedRootBounds = { rootBox.left, rootBox.top, rootBox.left + rootBox.width, rootBox.top + rootBox.height };
+
+	/* Children are quantized against the decoded bounds of their parent rather than its real ones.
+	 * The nodes are depth first, so each one is either childA of the node before it, or the childB of the parent on top of the stack.
+	 * Walking them in order keeps every read sequential, looking parents up by previousNode would jump all over the array.
+	 */
+	QuantizedBounds previousBounds = quantizedRootBounds;
+	for (uint32_t nodeIndex = 0; nodeIndex < bvh.size(); nodeIndex++)
+	{
+		const Node& node = bvh[nodeIndex];
+		QuantizedBounds parent = previousBounds;
+		if (nodeIndex > 0 && node.previousNode != nodeIndex - 1)
+		{
+			parent = quantizedParentStack.back();
+			quantizedParentStack.pop_back();
+		}
+		float stepX = (parent.maxX - parent.minX) * (1.0f / QUANTIZED_STEPS);
+		float stepY = (parent.maxY - parent.minY) * (1.0f / QUANTIZED_STEPS);
+
+		QuantizedNode& quantizedNode = bvhQuantized[nodeIndex];
+		quantizedNode.minX = QuantizeMin(node.boundingBox.left, parent.minX, stepX);
+		quantizedNode.minY = QuantizeMin(node.boundingBox.top, parent.minY, stepY);
+		quantizedNode.maxX = QuantizeMax(node.boundingBox.left + node.boundingBox.width, parent.maxX, stepX);
+		quantizedNode.maxY = QuantizeMax(node.boundingBox.top + node.boundingBox.height, parent.maxY, stepY);
+		quantizedNode.child = node.IsLeaf() ? node.firstObject : node.childB;
+		quantizedNode.objectCount = node.IsLeaf() ? node.objectCount : 0;
+		previousBounds = DequantizeBounds(quantizedNode, parent);
+		if (!node.IsLeaf())
+		{
+			quantizedParentStack.push_back(previousBounds);
+		}
+	}
+}
+
+// Memory ---------------------------------------------------------------------------------------------------------------------------
+
+// Nodes and object indices are trivially destructible, so clearing only resets the sizes
+void ClearBVH()
+{
+	bvhGeneration++;
+	bvh.clear();
+	bvhObjects.clear();
+	objectLeafNodes.clear();
+	bvh4.clear();
+	bvhQuantized.clear();
+}
+
+template <typename T>
+size_t CapacityInBytes(const std::vector<T>& buffer)
+{
+	return buffer.capacity() * sizeof(T);
+}
+
+size_t BVHMemoryInBytes()
+{
+	std::lock_guard<std::mutex> lock(buildMutex);
+	return CapacityInBytes(bvh) + CapacityInBytes(bvhObjects) + CapacityInBytes(objectLeafNodes) + CapacityInBytes(bvh4) + CapacityInBytes(bvhQuantized) + CapacityInBytes(quantizedParentStack) +
+		CapacityInBytes(buildNodes) + CapacityInBytes(sortScratch) + CapacityInBytes(sahRightCosts) + CapacityInBytes(binnedBounds) +
+		CapacityInBytes(mortonKeys) + CapacityInBytes(mortonScratch) + CapacityInBytes(radixHistograms) + CapacityInBytes(mortonBlockBounds);
+}
+
+// Swapping with an empty vector is the only way to be sure the memory is given back
+template <typename T>
+void ReleaseBuffer(std::vector<T>& buffer)
+{
+	std::vector<T>().swap(buffer);
+}
+
+void ReleaseBVHMemory()
+{
+	std::lock_guard<std::mutex> lock(buildMutex);
+	ReleaseBuffer(bvh);
+	ReleaseBuffer(bvhObjects);
+	ReleaseBuffer(objectLeafNodes);
+	ReleaseBuffer(bvh4);
+	ReleaseBuffer(bvhQuantized);
+	ReleaseBuffer(quantizedParentStack);
+	ReleaseBuffer(buildNodes);
+	ReleaseBuffer(sortScratch);
+	ReleaseBuffer(sahRightCosts);
+	ReleaseBuffer(binnedBounds);
+	ReleaseBuffer(mortonKeys);
+	ReleaseBuffer(mortonScratch);
+	ReleaseBuffer(radixHistograms);
+	ReleaseBuffer(mortonBlockBounds);
+}
+
+// Batched queries ------------------------------------------------------------------------------------------------------------------
+
+ThreadPool threadPool;
+
+void QueryBVHBatch(const FloatRect* queries, uint32_t queryCount, BatchQueryResults& results)
+{
+	uint32_t blockCount = (queryCount + BATCH_QUERY_BLOCK_SIZE - 1) / BATCH_QUERY_BLOCK_SIZE;
+	results.offsets.resize(queryCount + 1);
+	results.blockObjects.resize(blockCount);
+	results.blockOffsets.resize(blockCount + 1);
+	results.offsets[0] = 0;
+
+	// Traverse, offsets[i + 1] temporarily holds the number of hits of query i
+	threadPool.Run(blockCount, [&](uint32_t block)
+	{
+		std::vector<uint32_t>& hits = results.blockObjects[block];
+		hits.clear();
+		uint32_t end = std::min(queryCount, (block + 1) * BATCH_QUERY_BLOCK_SIZE);
+		for (uint32_t query = block * BATCH_QUERY_BLOCK_SIZE; query < end; query++)
+		{
+			size_t hitsBefore = hits.size();
+			QueryBVH(queries[query], [&hits](uint32_t object) { hits.push_back(object); });
+			results.offsets[query + 1] = static_cast<uint32_t>(hits.size() - hitsBefore);
+		}
+	});
+
+	// Where each block starts in the flat list
+	results.blockOffsets[0] = 0;
+	for (uint32_t block = 0; block < blockCount; block++)
+	{
+		results.blockOffsets[block + 1] = results.blockOffsets[block] + static_cast<uint32_t>(results.blockObjects[block].size());
+	}
+	results.objects.resize(results.blockOffsets[blockCount]);
+
+	// Turn the counts into offsets and copy every block into place
+	threadPool.Run(blockCount, [&](uint32_t block)
+	{
+		uint32_t offset = results.blockOffsets[block];
+		uint32_t end = std::min(queryCount, (block + 1) * BATCH_QUERY_BLOCK_SIZE);
+		for (uint32_t query = block * BATCH_QUERY_BLOCK_SIZE; query < end; query++)
+		{
+			offset += results.offsets[query + 1];
+			results.offsets[query + 1] = offset;
+		}
+		std::copy(results.blockObjects[block].begin(), results.blockObjects[block].end(), results.objects.begin() + results.blockOffsets[block]);
+	});
+}
@@ -0,0 +1,1260 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+
+/* Core of the BVH, free of SFML so it can be used by the visualiser and the benchmark alike.
+ * Objects, nodes and the trees built from them are globals, in the same way the visualiser uses them.
+ */
+
+struct FloatRect {
+	FloatRect() = default;
+	FloatRect(float _left, float _top, float _width, float _height) {
+		left = _left;
+		top = _top;
+		width = _width;
+		height = _height;
+	}
+
+	float left = 0;
+	float top = 0;
+	float width = 0;
+	float height = 0;
+};
+
+/* GameObjects are split into hot and cold data, all addressed by the same object index.
+ * Only the bounds are touched by building, traversing and collision checks, so they are packed
+ * into their own arrays. Names and SFML visuals are kept in side tables by the visualiser.
+ */
+struct GameObjectBounds {
+	void Add(FloatRect boundingBox)
+	{
+		minX.push_back(boundingBox.left);
+		minY.push_back(boundingBox.top);
+		maxX.push_back(boundingBox.left + boundingBox.width);
+		maxY.push_back(boundingBox.top + boundingBox.height);
+	}
+
+	void Set(uint32_t object, FloatRect boundingBox)
+	{
+		minX[object] = boundingBox.left;
+		minY[object] = boundingBox.top;
+		maxX[object] = boundingBox.left + boundingBox.width;
+		maxY[object] = boundingBox.top + boundingBox.height;
+	}
+
+	void Clear()
+	{
+		minX.clear();
+		minY.clear();
+		maxX.clear();
+		maxY.clear();
+	}
+
+	void Reserve(uint32_t objectCount)
+	{
+		minX.reserve(objectCount);
+		minY.reserve(objectCount);
+		maxX.reserve(objectCount);
+		maxY.reserve(objectCount);
+	}
+
+	// Growing adds empty boxes at 0, 0 to be filled in with Set
+	void Resize(uint32_t objectCount)
+	{
+		minX.resize(objectCount);
+		minY.resize(objectCount);
+		maxX.resize(objectCount);
+		maxY.resize(objectCount);
+	}
+
+	FloatRect Get(uint32_t object) const
+	{
+		return FloatRect(minX[object], minY[object], maxX[object] - minX[object], maxY[object] - minY[object]);
+	}
+
+	uint32_t Size() const
+	{
+		return static_cast<uint32_t>(minX.size());
+	}
+
+	std::vector<float> minX;
+	std::vector<float> minY;
+	std::vector<float> maxX;
+	std::vector<float> maxY;
+};
+
+// Marks a missing child or parent index within the bvh node array
+constexpr uint32_t NULL_NODE = 0xFFFFFFFF;
+
+/* Nodes are stored in one linear array, laid out depth first.
+ * childA always sits directly after its parent (index + 1), so only childB needs storing.
+ * Each node covers a contiguous range of the bvhObjects vector.
+ */
+struct Node {
+	Node() = default;
+
+	// Defines GameObjects within that node
+	void DefineGameObjects(uint32_t _firstObject, uint32_t _objectCount)
+	{
+		firstObject = _firstObject;
+		objectCount = _objectCount;
+	}
+	// Bounds of the Node
+	void DefineBounds(float _left, float _top, float _width, float _height)
+	{
+		boundingBox.left = _left;
+		boundingBox.top = _top;
+		boundingBox.width = _width;
+		boundingBox.height = _height;
+	}
+
+	// Define the previous node and second child node, childA is implied by the layout
+	void DefineChildB(uint32_t _childB)
+	{
+		childB = _childB;
+	}
+
+	void DefineParentNode(uint32_t _parentNode)
+	{
+		previousNode = _parentNode;
+	}
+
+	bool IsLeaf() const
+	{
+		return childB == NULL_NODE;
+	}
+
+	FloatRect boundingBox;
+	uint32_t previousNode = NULL_NODE;
+	uint32_t childB = NULL_NODE;
+	uint32_t firstObject = 0;
+	uint32_t objectCount = 0;
+};
+
+extern GameObjectBounds gameObjectBounds;
+
+// Object indices in the order the bvh nodes reference them, sorted instead of the objects themselves
+extern std::vector<uint32_t> bvhObjects;
+extern std::vector<Node> bvh;
+
+// Leaf node holding each object, used to find where to start refitting from
+extern std::vector<uint32_t> objectLeafNodes;
+
+// Time taken by the last call to CreateBVH
+extern float bvhBuild_timeInMs;
+
+// Changes every time the bvh is built, refitted or cleared, so anything holding on to its nodes can tell when they are out of date
+extern uint32_t bvhGeneration;
+
+inline bool BoxBoxCollision(FloatRect boxA, FloatRect boxB)
+{
+	if (boxA.left < boxB.left + boxB.width &&
+			boxA.left + boxA.width > boxB.left &&
+			boxA.top + boxA.height > boxB.top &&
+			boxA.top < boxB.top + boxB.height)
+	{
+		return true;
+	}
+	return false;
+}
+
+// Same test as BoxBoxCollision, but reads the object's bounds straight from the packed arrays
+inline bool BoxObjectCollision(FloatRect box, uint32_t object)
+{
+	return box.left < gameObjectBounds.maxX[object] &&
+		box.left + box.width > gameObjectBounds.minX[object] &&
+		box.top + box.height > gameObjectBounds.minY[object] &&
+		box.top < gameObjectBounds.maxY[object];
+}
+
+inline FloatRect UnionRect(const FloatRect& boxA, const FloatRect& boxB)
+{
+	float smallestX = std::min(boxA.left, boxB.left);
+	float smallestY = std::min(boxA.top, boxB.top);
+	float largestX = std::max(boxA.left + boxA.width, boxB.left + boxB.width);
+	float largestY = std::max(boxA.top + boxA.height, boxB.top + boxB.height);
+	return FloatRect(smallestX, smallestY, largestX - smallestX, largestY - smallestY);
+}
+
+inline float HalfPerimeter(const FloatRect& box)
+{
+	return box.width + box.height;
+}
+
+// BVH Stuff ------------------------------------------------------------------------------------------------------------------------
+
+// How CreateBVH splits nodes, see the Surface Area Heuristic, Binned Surface Area Heuristic and Linear BVH sections of BVH.cpp
+enum class BuildMode {
+	Median,
+	SurfaceAreaHeuristic,
+	BinnedSurfaceAreaHeuristic,
+	LinearMorton
+};
+
+/* multiThreaded builds the two subtrees of large nodes as separate tasks on the thread pool, the tree comes out the same
+ * The binned SAH is the default, it builds nearly as fast as LinearMorton with nearly the query speed of SurfaceAreaHeuristic
+ * Nodes holding maxLeafObjects or fewer objects become leaves, larger leaves make a smaller tree that is quicker to build
+ * Waits for any background rebuild that is building at the time, the two share the build scratch space
+ */
+void CreateBVH(BuildMode buildMode = BuildMode::BinnedSurfaceAreaHeuristic, bool multiThreaded = false, uint32_t maxLeafObjects = 2);
+
+/* Same as CreateBVH, but builds from a copy of the object bounds into a tree of its own, see BackgroundBVH.h.
+ * nodes, objects and leafNodes take the place of bvh, bvhObjects and objectLeafNodes, which are left untouched along with bvhGeneration.
+ * Shares the scratch space of CreateBVH, so whichever of the two starts second waits for the first. Returns the time taken in milliseconds
+ */
+float CreateBVHFromBounds(const GameObjectBounds& bounds, std::vector<Node>& nodes, std::vector<uint32_t>& objects, std::vector<uint32_t>& leafNodes,
+	BuildMode buildMode, bool multiThreaded = false, uint32_t maxLeafObjects = 2);
+
+/* Every buffer behind the bvh, the scratch space of the builds included, keeps its capacity from one build to the next.
+ * Once the scene has been built at its largest size, rebuilding allocates nothing and memory use stays flat.
+ */
+// Empties the bvh, bvh4 and bvhQuantized in O(1), keeping their memory for the next build
+void ClearBVH();
+
+// Bytes reserved by the bvh, bvh4, bvhQuantized and the build scratch space, waits for a background rebuild that is building
+size_t BVHMemoryInBytes();
+
+// Frees everything ClearBVH keeps, for when the scene has shrunk for good. Waits for a background rebuild that is building
+void ReleaseBVHMemory();
+
+// Recalculates the bounds of one node from its objects or children, returns true if they changed
+bool CalculateBoundsOfNode(uint32_t nodeIndex);
+
+/* Refitting -----------------------------------------------------------------------------------------------------------------------
+ * Moved objects only update the bounds of their leaf and the nodes above it, the shape of the tree stays the same.
+ * Quality drops as objects drift away from where they were built, so rebuild every now and then.
+ * bvh4 is a copy of the bounds, call CreateBVH4 again after refitting if it is used.
+ * Update the moved objects with gameObjectBounds.Set first.
+ */
+void RefitBVH(const std::vector<uint32_t>& movedObjects);
+
+/* Deep enough for any tree built here, the median split is log2(n) deep.
+ * A pathological SAH tree can go deeper, in which case the traversal continues on the call stack.
+ */
+constexpr int TRAVERSAL_STACK_SIZE = 64;
+
+// Ignores the bvh and checks every object, useful to check if the bvh is working correctly
+template <typename Callback>
+void BruteForceQuery(FloatRect searchRect, Callback&& onObjectHit)
+{
+	for (uint32_t object = 0; object < gameObjectBounds.Size(); object++)
+	{
+		if (BoxObjectCollision(searchRect, object))
+		{
+			onObjectHit(object);
+		}
+	}
+}
+
+/* Everything a box query reads, as plain pointers.
+ * The same traversal then runs over the globals or over a bvh mapped straight from a file, see BVHFile.h.
+ */
+struct BVHView {
+	const Node* nodes = nullptr;
+	uint32_t nodeCount = 0;
+	// Object indices in bvh order, then the bounds of every object by object index
+	const uint32_t* objects = nullptr;
+	const float* minX = nullptr;
+	const float* minY = nullptr;
+	const float* maxX = nullptr;
+	const float* maxY = nullptr;
+	uint32_t objectCount = 0;
+};
+
+inline BVHView CurrentBVHView()
+{
+	BVHView view;
+	view.nodes = bvh.data();
+	view.nodeCount = static_cast<uint32_t>(bvh.size());
+	view.objects = bvhObjects.data();
+	view.minX = gameObjectBounds.minX.data();
+	view.minY = gameObjectBounds.minY.data();
+	view.maxX = gameObjectBounds.maxX.data();
+	view.maxY = gameObjectBounds.maxY.data();
+	view.objectCount = gameObjectBounds.Size();
+	return view;
+}
+
+/* The depth first walk behind every box query, over any node type laid out like Node: childA directly after its parent,
+ * only childB stored and IsLeaf() telling the two apart. GenericBVH walks its nodes with this as well.
+ * enterNode(node) says whether the search reaches into a node, and visitLeaf(node) checks the objects of every leaf it reaches.
+ * childA is always visited straight away, only childB is pushed onto the fixed size stack.
+ */
+template <typename NodeType, typename EnterNode, typename VisitLeaf>
+void TraverseNodes(const NodeType* nodes, uint32_t nodeCount, uint32_t startNode, EnterNode& enterNode, VisitLeaf& visitLeaf)
+{
+	if (startNode >= nodeCount)
+	{
+		return;
+	}
+
+	uint32_t stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	uint32_t currentNode = startNode;
+
+	while (true)
+	{
+		const NodeType& node = nodes[currentNode];
+		if (enterNode(node))
+		{
+			if (!node.IsLeaf())
+			{
+				if (stackSize == TRAVERSAL_STACK_SIZE)
+				{
+					TraverseNodes(nodes, nodeCount, node.childB, enterNode, visitLeaf);
+				}
+				else
+				{
+					stack[stackSize++] = node.childB;
+				}
+				currentNode++;
+				continue;
+			}
+
+			visitLeaf(node);
+		}
+
+		if (stackSize == 0)
+		{
+			return;
+		}
+		currentNode = stack[--stackSize];
+	}
+}
+
+// Iterative traversal, calls onObjectHit(objectIndex) for every object colliding with searchRect
+template <typename Callback>
+void QueryBVHView(const BVHView& view, FloatRect searchRect, Callback&& onObjectHit, uint32_t startNode = 0)
+{
+	// Only proceed into a node if the searchRect is within it
+	auto enterNode = [&searchRect](const Node& node) { return BoxBoxCollision(searchRect, node.boundingBox); };
+
+	// Check collisions with objects inside of the leaf node
+	auto visitLeaf = [&view, &searchRect, &onObjectHit](const Node& node)
+	{
+		for (uint32_t i = node.firstObject; i < node.firstObject + node.objectCount; i++)
+		{
+			uint32_t object = view.objects[i];
+			if (searchRect.left < view.maxX[object] &&
+					searchRect.left + searchRect.width > view.minX[object] &&
+					searchRect.top + searchRect.height > view.minY[object] &&
+					searchRect.top < view.maxY[object])
+			{
+				onObjectHit(object);
+			}
+		}
+	};
+
+	TraverseNodes(view.nodes, view.nodeCount, startNode, enterNode, visitLeaf);
+}
+
+template <typename Callback>
+void QueryBVH(FloatRect searchRect, Callback&& onObjectHit, uint32_t startNode = 0)
+{
+	QueryBVHView(CurrentBVHView(), searchRect, onObjectHit, startNode);
+}
+
+/* Coherent queries -----------------------------------------------------------------------------------------------------------------
+ * For a search box that moves a little each frame, each one keeps a QueryContext between frames.
+ * The context remembers the deepest node that fully held the last search box, and the next query climbs from there
+ * through previousNode only until a node holds the new box again, rather than descending from the root every time.
+ *
+ * Subtrees beside that node's path from the root can reach into its bounds, and may hold objects the search box hits.
+ * The context keeps the few that do, found once when the node changes, so a box that stays put skips the path entirely.
+ * The hits are the same as QueryBVH gives, in a different order.
+ */
+struct QueryContext {
+	uint32_t containingNode = NULL_NODE;
+	// Roots of the subtrees off the path to containingNode whose bounds overlap it
+	std::vector<uint32_t> overlappingSubtrees;
+	// bvhGeneration when they were found, they are found again after every build or refit
+	uint32_t generation = 0;
+};
+
+inline bool BoxContainsBox(FloatRect outer, FloatRect inner)
+{
+	return inner.left >= outer.left && inner.top >= outer.top &&
+		inner.left + inner.width <= outer.left + outer.width && inner.top + inner.height <= outer.top + outer.height;
+}
+
+template <typename Callback>
+void QueryBVHCoherent(QueryContext& context, FloatRect searchRect, Callback&& onObjectHit)
+{
+	BVHView view = CurrentBVHView();
+	if (view.nodeCount == 0)
+	{
+		return;
+	}
+
+	bool upToDate = context.generation == bvhGeneration && context.containingNode < view.nodeCount;
+	uint32_t node = upToDate ? context.containingNode : 0;
+
+	// Climb until a node holds the whole search box, stopping at the root if none does
+	while (view.nodes[node].previousNode != NULL_NODE && !BoxContainsBox(view.nodes[node].boundingBox, searchRect))
+	{
+		node = view.nodes[node].previousNode;
+	}
+
+	// Then back down for as long as a child still holds it
+	while (!view.nodes[node].IsLeaf())
+	{
+		if (BoxContainsBox(view.nodes[node + 1].boundingBox, searchRect))
+		{
+			node = node + 1;
+		}
+		else if (BoxContainsBox(view.nodes[view.nodes[node].childB].boundingBox, searchRect))
+		{
+			node = view.nodes[node].childB;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	/* An object the search box hits overlaps the node's bounds, so a subtree that does not overlap them holds none.
+	 * At the root the box may not fit, but then there is no path to check.
+	 */
+	if (!upToDate || node != context.containingNode)
+	{
+		context.containingNode = node;
+		context.generation = bvhGeneration;
+		context.overlappingSubtrees.clear();
+		for (uint32_t child = node, parent = view.nodes[node].previousNode; parent != NULL_NODE; child = parent, parent = view.nodes[parent].previousNode)
+		{
+			uint32_t sibling = child == parent + 1 ? view.nodes[parent].childB : parent + 1;
+			if (BoxBoxCollision(view.nodes[sibling].boundingBox, view.nodes[node].boundingBox))
+			{
+				context.overlappingSubtrees.push_back(sibling);
+			}
+		}
+	}
+
+	QueryBVHView(view, searchRect, onObjectHit, node);
+	for (uint32_t subtree : context.overlappingSubtrees)
+	{
+		QueryBVHView(view, searchRect, onObjectHit, subtree);
+	}
+}
+
+/* 4-wide BVH -----------------------------------------------------------------------------------------------------------------------
+ * Collapsed from the binary bvh so that every node holds the bounds of up to four children side by side.
+ * One SSE compare sequence then tests the search box against all four children at once.
+ * Define BVH_NO_SIMD to force the scalar fallback.
+ */
+#if !defined(BVH_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BVH_USE_SSE 1
+#include <emmintrin.h>
+#else
+#define BVH_USE_SSE 0
+#endif
+
+struct Node4 {
+	// Bounds of every child, one lane per child. Unused lanes are inverted so nothing can overlap them
+	alignas(16) float minX[4];
+	alignas(16) float minY[4];
+	alignas(16) float maxX[4];
+	alignas(16) float maxY[4];
+
+	// Index of the child Node4, or the first object within bvhObjects for leaf children
+	uint32_t child[4];
+	// Number of objects for leaf children, 0 for inner children and unused lanes
+	uint32_t objectCount[4];
+};
+
+extern std::vector<Node4> bvh4;
+
+// Builds bvh4 from the current binary bvh, CreateBVH has to be called first
+void CreateBVH4();
+
+// Returns a bit per lane of the node whose bounds collide with searchRect
+inline int CollideChildren4(FloatRect searchRect, const Node4& node)
+{
+#if BVH_USE_SSE
+	__m128 left = _mm_set1_ps(searchRect.left);
+	__m128 top = _mm_set1_ps(searchRect.top);
+	__m128 right = _mm_set1_ps(searchRect.left + searchRect.width);
+	__m128 bottom = _mm_set1_ps(searchRect.top + searchRect.height);
+
+	__m128 overlapX = _mm_and_ps(_mm_cmplt_ps(left, _mm_load_ps(node.maxX)), _mm_cmpgt_ps(right, _mm_load_ps(node.minX)));
+	__m128 overlapY = _mm_and_ps(_mm_cmpgt_ps(bottom, _mm_load_ps(node.minY)), _mm_cmplt_ps(top, _mm_load_ps(node.maxY)));
+	return _mm_movemask_ps(_mm_and_ps(overlapX, overlapY));
+#else
+	float right = searchRect.left + searchRect.width;
+	float bottom = searchRect.top + searchRect.height;
+	int mask = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		bool collided = (searchRect.left < node.maxX[i]) & (right > node.minX[i]) & (bottom > node.minY[i]) & (searchRect.top < node.maxY[i]);
+		mask |= static_cast<int>(collided) << i;
+	}
+	return mask;
+#endif
+}
+
+// Same as QueryBVH, but walks bvh4 instead of the binary bvh
+template <typename Callback>
+void QueryBVH4(FloatRect searchRect, Callback&& onObjectHit, uint32_t startNode = 0)
+{
+	if (startNode >= bvh4.size())
+	{
+		return;
+	}
+
+	uint32_t stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = startNode;
+
+	while (stackSize > 0)
+	{
+		const Node4& node = bvh4[stack[--stackSize]];
+		int mask = CollideChildren4(searchRect, node);
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (!(mask & (1 << i)))
+			{
+				continue;
+			}
+
+			if (node.objectCount[i] == 0)
+			{
+				if (stackSize == TRAVERSAL_STACK_SIZE)
+				{
+					QueryBVH4(searchRect, onObjectHit, node.child[i]);
+				}
+				else
+				{
+					stack[stackSize++] = node.child[i];
+				}
+				continue;
+			}
+
+			// Check collisions with objects inside of the leaf child
+			for (uint32_t j = node.child[i]; j < node.child[i] + node.objectCount[i]; j++)
+			{
+				if (BoxObjectCollision(searchRect, bvhObjects[j]))
+				{
+					onObjectHit(bvhObjects[j]);
+				}
+			}
+		}
+	}
+}
+
+/* Quantized BVH --------------------------------------------------------------------------------------------------------------------
+ * A half size copy of the binary bvh for large static scenes, where traversal is limited by memory bandwidth.
+ * Every node stores its bounds as 16 bit steps across its parent's bounds, rounded outwards, so the decoded bounds
+ * always contain the real ones and no object is missed. Only the root bounds are kept as floats.
+ * The layout is the same as bvh, childA directly after its parent, so the nodes are decoded on the way down.
+ * Call CreateQuantizedBVH again after every rebuild or refit.
+ */
+constexpr uint32_t QUANTIZED_STEPS = 0xFFFF;
+
+struct QuantizedNode {
+	bool IsLeaf() const
+	{
+		return objectCount != 0;
+	}
+
+	// Bounds in QUANTIZED_STEPS of the parent's decoded bounds
+	uint16_t minX;
+	uint16_t minY;
+	uint16_t maxX;
+	uint16_t maxY;
+	// childB for inner nodes, the first object within bvhObjects for leaves
+	uint32_t child;
+	// 0 for inner nodes
+	uint32_t objectCount;
+};
+
+static_assert(sizeof(QuantizedNode) == 16, "QuantizedNode should stay at half the size of Node");
+
+// Decoded bounds of a quantized node
+struct QuantizedBounds {
+	float minX;
+	float minY;
+	float maxX;
+	float maxY;
+};
+
+extern std::vector<QuantizedNode> bvhQuantized;
+extern QuantizedBounds quantizedRootBounds;
+
+// Builds bvhQuantized from the current binary bvh, CreateBVH has to be called first
+void CreateQuantizedBVH();
+
+/* Steps are counted up from the parent's min for a child's min, and down from the parent's max for a child's max.
+ * That way 0 and QUANTIZED_STEPS decode to exactly the parent's bounds, and CreateQuantizedBVH rounds outwards using these same functions.
+ */
+inline float DequantizeMin(uint16_t steps, float parentMin, float stepSize)
+{
+	return parentMin + steps * stepSize;
+}
+
+inline float DequantizeMax(uint16_t steps, float parentMax, float stepSize)
+{
+	return parentMax - (QUANTIZED_STEPS - steps) * stepSize;
+}
+
+inline QuantizedBounds DequantizeBounds(const QuantizedNode& node, const QuantizedBounds& parent)
+{
+	float stepX = (parent.maxX - parent.minX) * (1.0f / QUANTIZED_STEPS);
+	float stepY = (parent.maxY - parent.minY) * (1.0f / QUANTIZED_STEPS);
+	QuantizedBounds bounds;
+	bounds.minX = DequantizeMin(node.minX, parent.minX, stepX);
+	bounds.minY = DequantizeMin(node.minY, parent.minY, stepY);
+	bounds.maxX = DequantizeMax(node.maxX, parent.maxX, stepX);
+	bounds.maxY = DequantizeMax(node.maxY, parent.maxY, stepY);
+	return bounds;
+}
+
+inline bool BoxQuantizedCollision(FloatRect box, const QuantizedBounds& bounds)
+{
+	return box.left < bounds.maxX &&
+		box.left + box.width > bounds.minX &&
+		box.top + box.height > bounds.minY &&
+		box.top < bounds.maxY;
+}
+
+/* Same results as QueryBVH, plus any extra nodes entered because of the rounding.
+ * Both children are decoded and tested at their parent, and the stack holds the decoded bounds of each pushed childB.
+ */
+template <typename Callback>
+void QueryQuantizedBVH(FloatRect searchRect, Callback&& onObjectHit, uint32_t startNode = 0, QuantizedBounds startBounds = quantizedRootBounds)
+{
+	if (startNode >= bvhQuantized.size() || !BoxQuantizedCollision(searchRect, startBounds))
+	{
+		return;
+	}
+
+	struct StackEntry {
+		uint32_t node;
+		QuantizedBounds bounds;
+	};
+	StackEntry stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	uint32_t currentNode = startNode;
+	QuantizedBounds currentBounds = startBounds;
+
+	while (true)
+	{
+		const QuantizedNode& node = bvhQuantized[currentNode];
+		if (!node.IsLeaf())
+		{
+			QuantizedBounds boundsA = DequantizeBounds(bvhQuantized[currentNode + 1], currentBounds);
+			QuantizedBounds boundsB = DequantizeBounds(bvhQuantized[node.child], currentBounds);
+			bool collidedA = BoxQuantizedCollision(searchRect, boundsA);
+			bool collidedB = BoxQuantizedCollision(searchRect, boundsB);
+			if (collidedA)
+			{
+				if (collidedB)
+				{
+					if (stackSize == TRAVERSAL_STACK_SIZE)
+					{
+						QueryQuantizedBVH(searchRect, onObjectHit, node.child, boundsB);
+					}
+					else
+					{
+						stack[stackSize++] = { node.child, boundsB };
+					}
+				}
+				currentNode++;
+				currentBounds = boundsA;
+				continue;
+			}
+			if (collidedB)
+			{
+				currentNode = node.child;
+				currentBounds = boundsB;
+				continue;
+			}
+		}
+		else
+		{
+			// Objects are checked against their real bounds, so the rounding never adds hits
+			for (uint32_t i = node.child; i < node.child + node.objectCount; i++)
+			{
+				if (BoxObjectCollision(searchRect, bvhObjects[i]))
+				{
+					onObjectHit(bvhObjects[i]);
+				}
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			return;
+		}
+		stackSize--;
+		currentNode = stack[stackSize].node;
+		currentBounds = stack[stackSize].bounds;
+	}
+}
+
+/* Self collision -------------------------------------------------------------------------------------------------------------------
+ * Finds every pair of overlapping objects by walking the bvh against itself.
+ * A pair of objects is only ever reached through the lowest node holding both, so every pair is found exactly once.
+ */
+inline bool ObjectObjectCollision(uint32_t objectA, uint32_t objectB)
+{
+	return gameObjectBounds.minX[objectA] < gameObjectBounds.maxX[objectB] &&
+		gameObjectBounds.maxX[objectA] > gameObjectBounds.minX[objectB] &&
+		gameObjectBounds.maxY[objectA] > gameObjectBounds.minY[objectB] &&
+		gameObjectBounds.minY[objectA] < gameObjectBounds.maxY[objectB];
+}
+
+/* Calls onPair(objectA, objectB) with objectA < objectB for every pair of overlapping objects.
+ * Each stack entry is a pair of nodes, a node paired with itself stands for all pairs within that node.
+ */
+template <typename Callback>
+void FindCollidingPairs(Callback&& onPair, uint32_t startNodeA = 0, uint32_t startNodeB = 0)
+{
+	if (startNodeA >= bvh.size())
+	{
+		return;
+	}
+
+	uint32_t stack[TRAVERSAL_STACK_SIZE][2];
+	int stackSize = 0;
+	auto push = [&](uint32_t nodeA, uint32_t nodeB)
+	{
+		if (stackSize == TRAVERSAL_STACK_SIZE)
+		{
+			FindCollidingPairs(onPair, nodeA, nodeB);
+			return;
+		}
+		stack[stackSize][0] = nodeA;
+		stack[stackSize][1] = nodeB;
+		stackSize++;
+	};
+	auto report = [&](uint32_t objectA, uint32_t objectB)
+	{
+		if (ObjectObjectCollision(objectA, objectB))
+		{
+			objectA < objectB ? onPair(objectA, objectB) : onPair(objectB, objectA);
+		}
+	};
+
+	push(startNodeA, startNodeB);
+	while (stackSize > 0)
+	{
+		stackSize--;
+		uint32_t nodeIndexA = stack[stackSize][0];
+		uint32_t nodeIndexB = stack[stackSize][1];
+		const Node& nodeA = bvh[nodeIndexA];
+		const Node& nodeB = bvh[nodeIndexB];
+
+		if (nodeIndexA == nodeIndexB)
+		{
+			if (nodeA.IsLeaf())
+			{
+				// Pairs within the leaf
+				for (uint32_t i = nodeA.firstObject; i < nodeA.firstObject + nodeA.objectCount; i++)
+				{
+					for (uint32_t j = i + 1; j < nodeA.firstObject + nodeA.objectCount; j++)
+					{
+						report(bvhObjects[i], bvhObjects[j]);
+					}
+				}
+				continue;
+			}
+			// Pairs within either child, then pairs across the two children
+			push(nodeIndexA + 1, nodeA.childB);
+			push(nodeA.childB, nodeA.childB);
+			push(nodeIndexA + 1, nodeIndexA + 1);
+			continue;
+		}
+
+		if (!BoxBoxCollision(nodeA.boundingBox, nodeB.boundingBox))
+		{
+			continue;
+		}
+
+		if (nodeA.IsLeaf() && nodeB.IsLeaf())
+		{
+			for (uint32_t i = nodeA.firstObject; i < nodeA.firstObject + nodeA.objectCount; i++)
+			{
+				for (uint32_t j = nodeB.firstObject; j < nodeB.firstObject + nodeB.objectCount; j++)
+				{
+					report(bvhObjects[i], bvhObjects[j]);
+				}
+			}
+			continue;
+		}
+
+		// Open the larger of the two nodes, or the only one that is not a leaf
+		bool openA = nodeB.IsLeaf() ||
+			(!nodeA.IsLeaf() && HalfPerimeter(nodeA.boundingBox) > HalfPerimeter(nodeB.boundingBox));
+		if (openA)
+		{
+			push(nodeA.childB, nodeIndexB);
+			push(nodeIndexA + 1, nodeIndexB);
+		}
+		else
+		{
+			push(nodeIndexA, nodeB.childB);
+			push(nodeIndexA, nodeIndexB + 1);
+		}
+	}
+}
+
+/* Ray casting ----------------------------------------------------------------------------------------------------------------------
+ * Finds the closest object along a ray or segment, the points along it being origin + direction * t for t in [0, maxT].
+ * Boxes are tested with the slab test, using the inverse of the direction worked out once per cast.
+ * The nearer child is always visited first and maxT shrinks to every hit found, so nodes behind the closest hit are skipped.
+ */
+constexpr uint32_t NULL_OBJECT = 0xFFFFFFFF;
+
+struct Ray {
+	Ray(float _originX, float _originY, float _directionX, float _directionY, float _maxT = FLT_MAX) {
+		originX = _originX;
+		originY = _originY;
+		directionX = _directionX;
+		directionY = _directionY;
+		maxT = _maxT;
+	}
+
+	float originX = 0;
+	float originY = 0;
+	float directionX = 0;
+	float directionY = 0;
+	float maxT = FLT_MAX;
+};
+
+// A segment is the ray from its start towards its end, stopping at t = 1
+inline Ray SegmentRay(float startX, float startY, float endX, float endY)
+{
+	return Ray(startX, startY, endX - startX, endY - startY, 1.0f);
+}
+
+// object is NULL_OBJECT when nothing was hit
+struct RayHit {
+	uint32_t object = NULL_OBJECT;
+	float t = FLT_MAX;
+};
+
+// Every object is accepted unless CastRay is given a filter
+struct AcceptAllObjects {
+	bool operator()(uint32_t) const { return true; }
+};
+
+// A ray with the inverse of its direction, a zero direction gives an inverse of +infinity whatever the sign of the zero
+struct PreparedRay {
+	explicit PreparedRay(const Ray& ray)
+	{
+		originX = ray.originX;
+		originY = ray.originY;
+		inverseX = Inverse(ray.directionX);
+		inverseY = Inverse(ray.directionY);
+	}
+
+	static float Inverse(float direction)
+	{
+		float inverse = 1.0f / direction;
+		return inverse < -FLT_MAX ? -inverse : inverse;
+	}
+
+	float originX;
+	float originY;
+	float inverseX;
+	float inverseY;
+};
+
+/* Slab test, returns true if the ray enters the box before maxT and writes the t it enters at to entryT.
+ * Rays starting inside the box enter at 0. An origin lying exactly on either edge of the slab of a zero direction
+ * makes one NaN, PreparedRay gives such an axis an inverse of +infinity so the NaN always lands where the min and max
+ * calls below drop it, and the ray counts as within that slab on both edges, as touching a box counts as hitting it.
+ */
+inline bool RayBoxEntry(const PreparedRay& ray, float maxT, float minX, float minY, float maxX, float maxY, float& entryT)
+{
+	float tx1 = (minX - ray.originX) * ray.inverseX;
+	float tx2 = (maxX - ray.originX) * ray.inverseX;
+	float ty1 = (minY - ray.originY) * ray.inverseY;
+	float ty2 = (maxY - ray.originY) * ray.inverseY;
+
+	// std::min and std::max return their first argument whenever either is a NaN
+	float tNear = std::max(0.0f, std::min(tx1, tx2));
+	tNear = std::max(tNear, std::min(ty1, ty2));
+	float tFar = std::min(maxT, std::max(tx2, tx1));
+	tFar = std::min(tFar, std::max(ty2, ty1));
+
+	entryT = tNear;
+	return tNear <= tFar;
+}
+
+inline bool RayNodeEntry(const PreparedRay& ray, float maxT, const Node& node, float& entryT)
+{
+	const FloatRect& box = node.boundingBox;
+	return RayBoxEntry(ray, maxT, box.left, box.top, box.left + box.width, box.top + box.height, entryT);
+}
+
+inline bool RayObjectEntry(const PreparedRay& ray, float maxT, uint32_t object, float& entryT)
+{
+	return RayBoxEntry(ray, maxT, gameObjectBounds.minX[object], gameObjectBounds.minY[object],
+		gameObjectBounds.maxX[object], gameObjectBounds.maxY[object], entryT);
+}
+
+// Ignores the bvh and tests every object, useful to check CastRay against
+template <typename Filter = AcceptAllObjects>
+RayHit BruteForceCastRay(const Ray& ray, Filter&& acceptObject = Filter())
+{
+	PreparedRay prepared(ray);
+	RayHit closest;
+	float maxT = ray.maxT;
+	for (uint32_t object = 0; object < gameObjectBounds.Size(); object++)
+	{
+		float t;
+		if (RayObjectEntry(prepared, maxT, object, t) && t < closest.t && acceptObject(object))
+		{
+			closest.object = object;
+			closest.t = t;
+			maxT = t;
+		}
+	}
+	return closest;
+}
+
+/* Used by CastRay, walks the subtree under startNode and updates closest and maxT with every closer hit.
+ * Each stack entry keeps the t the ray enters its node at, so entries left behind a closer hit are dropped when popped.
+ */
+template <typename Filter>
+void CastRayFromNode(const PreparedRay& ray, uint32_t startNode, Filter& acceptObject, RayHit& closest, float& maxT)
+{
+	uint32_t stackNodes[TRAVERSAL_STACK_SIZE];
+	float stackEntries[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+
+	uint32_t currentNode = startNode;
+	float entryT;
+	bool entered = RayNodeEntry(ray, maxT, bvh[currentNode], entryT);
+
+	while (true)
+	{
+		if (entered && entryT <= maxT)
+		{
+			const Node& node = bvh[currentNode];
+			if (!node.IsLeaf())
+			{
+				uint32_t nearNode = currentNode + 1;
+				uint32_t farNode = node.childB;
+				float nearT, farT;
+				bool enteredNear = RayNodeEntry(ray, maxT, bvh[nearNode], nearT);
+				bool enteredFar = RayNodeEntry(ray, maxT, bvh[farNode], farT);
+				if (enteredFar && (!enteredNear || farT < nearT))
+				{
+					std::swap(nearNode, farNode);
+					std::swap(nearT, farT);
+					std::swap(enteredNear, enteredFar);
+				}
+
+				if (enteredFar)
+				{
+					if (stackSize == TRAVERSAL_STACK_SIZE)
+					{
+						CastRayFromNode(ray, farNode, acceptObject, closest, maxT);
+					}
+					else
+					{
+						stackNodes[stackSize] = farNode;
+						stackEntries[stackSize] = farT;
+						stackSize++;
+					}
+				}
+				if (enteredNear)
+				{
+					currentNode = nearNode;
+					entryT = nearT;
+					continue;
+				}
+			}
+			else
+			{
+				for (uint32_t i = node.firstObject; i < node.firstObject + node.objectCount; i++)
+				{
+					uint32_t object = bvhObjects[i];
+					float t;
+					if (RayObjectEntry(ray, maxT, object, t) && t < closest.t && acceptObject(object))
+					{
+						closest.object = object;
+						closest.t = t;
+						maxT = t;
+					}
+				}
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			return;
+		}
+		stackSize--;
+		currentNode = stackNodes[stackSize];
+		entryT = stackEntries[stackSize];
+		entered = true;
+	}
+}
+
+/* Returns the closest object along the ray that acceptObject(objectIndex) returns true for, and the t it is hit at.
+ * The filter is only asked about objects that would become the closest hit, e.g. to skip the object casting the ray.
+ */
+template <typename Filter = AcceptAllObjects>
+RayHit CastRay(const Ray& ray, Filter&& acceptObject = Filter())
+{
+	RayHit closest;
+	if (bvh.empty())
+	{
+		return closest;
+	}
+	float maxT = ray.maxT;
+	CastRayFromNode(PreparedRay(ray), 0, acceptObject, closest, maxT);
+	return closest;
+}
+
+/* Nearest objects ------------------------------------------------------------------------------------------------------------------
+ * Finds the objects closest to a search box, measured as the squared gap between the box and each object's bounds.
+ * A point is a search box with no width or height, and objects overlapping the search box are at distance 0.
+ * Equally distant objects are ordered by object index, so the results never depend on the shape of the tree.
+ */
+struct NearestObject {
+	uint32_t object = NULL_OBJECT;
+	float distanceSquared = FLT_MAX;
+};
+
+// Orders by distance, then by object index
+inline bool CloserThan(const NearestObject& a, const NearestObject& b)
+{
+	return a.distanceSquared < b.distanceSquared || (a.distanceSquared == b.distanceSquared && a.object < b.object);
+}
+
+// Squared distance across the gap between the box and the bounds, 0 when they touch or overlap
+inline float BoxDistanceSquared(FloatRect box, float minX, float minY, float maxX, float maxY)
+{
+	float gapX = std::max(0.0f, std::max(minX - (box.left + box.width), box.left - maxX));
+	float gapY = std::max(0.0f, std::max(minY - (box.top + box.height), box.top - maxY));
+	return gapX * gapX + gapY * gapY;
+}
+
+inline float NodeDistanceSquared(FloatRect box, const Node& node)
+{
+	const FloatRect& bounds = node.boundingBox;
+	return BoxDistanceSquared(box, bounds.left, bounds.top, bounds.left + bounds.width, bounds.top + bounds.height);
+}
+
+inline float ObjectDistanceSquared(FloatRect box, uint32_t object)
+{
+	return BoxDistanceSquared(box, gameObjectBounds.minX[object], gameObjectBounds.minY[object],
+		gameObjectBounds.maxX[object], gameObjectBounds.maxY[object]);
+}
+
+/* Results of FindNearestObjects along with the scratch space it works in.
+ * Reuse one per caller, nothing is allocated once the vectors have grown to fit.
+ */
+struct NearestObjects {
+	// The closest objects, closest first
+	std::vector<NearestObject> objects;
+
+	// Nodes still to be opened and their distance, a min heap on distance
+	struct NodeDistance {
+		uint32_t node;
+		float distanceSquared;
+	};
+	std::vector<NodeDistance> frontier;
+};
+
+/* Best first search, fills nearest.objects with the k closest objects that acceptObject(objectIndex) returns true for.
+ * Nodes are opened closest first, while the objects found so far are kept in a max heap of at most k entries.
+ * The search stops as soon as the closest unopened node is farther away than the k-th closest object.
+ */
+template <typename Filter = AcceptAllObjects>
+void FindNearestObjects(FloatRect searchBox, uint32_t k, NearestObjects& nearest, Filter&& acceptObject = Filter())
+{
+	std::vector<NearestObject>& objects = nearest.objects;
+	std::vector<NearestObjects::NodeDistance>& frontier = nearest.frontier;
+	objects.clear();
+	frontier.clear();
+	if (bvh.empty() || k == 0)
+	{
+		return;
+	}
+
+	auto fartherNode = [](const NearestObjects::NodeDistance& a, const NearestObjects::NodeDistance& b)
+	{
+		return a.distanceSquared > b.distanceSquared;
+	};
+	// Anything farther than the k-th closest object so far can not make it into the results
+	auto worstDistance = [&objects, k]()
+	{
+		return objects.size() < k ? FLT_MAX : objects.front().distanceSquared;
+	};
+
+	frontier.push_back({ 0, NodeDistanceSquared(searchBox, bvh[0]) });
+	while (!frontier.empty())
+	{
+		std::pop_heap(frontier.begin(), frontier.end(), fartherNode);
+		NearestObjects::NodeDistance current = frontier.back();
+		frontier.pop_back();
+
+		// Every node left in the frontier is at least this far away
+		if (current.distanceSquared > worstDistance())
+		{
+			break;
+		}
+
+		const Node& node = bvh[current.node];
+		if (!node.IsLeaf())
+		{
+			uint32_t children[2] = { current.node + 1, node.childB };
+			for (uint32_t child : children)
+			{
+				float distanceSquared = NodeDistanceSquared(searchBox, bvh[child]);
+				if (distanceSquared <= worstDistance())
+				{
+					frontier.push_back({ child, distanceSquared });
+					std::push_heap(frontier.begin(), frontier.end(), fartherNode);
+				}
+			}
+			continue;
+		}
+
+		for (uint32_t i = node.firstObject; i < node.firstObject + node.objectCount; i++)
+		{
+			NearestObject candidate{ bvhObjects[i], ObjectDistanceSquared(searchBox, bvhObjects[i]) };
+			if ((objects.size() == k && !CloserThan(candidate, objects.front())) || !acceptObject(candidate.object))
+			{
+				continue;
+			}
+			objects.push_back(candidate);
+			std::push_heap(objects.begin(), objects.end(), CloserThan);
+			if (objects.size() > k)
+			{
+				std::pop_heap(objects.begin(), objects.end(), CloserThan);
+				objects.pop_back();
+			}
+		}
+	}
+	std::sort_heap(objects.begin(), objects.end(), CloserThan);
+}
+
+// Ignores the bvh and checks every object, useful to check FindNearestObjects against
+template <typename Filter = AcceptAllObjects>
+void BruteForceNearestObjects(FloatRect searchBox, uint32_t k, NearestObjects& nearest, Filter&& acceptObject = Filter())
+{
+	std::vector<NearestObject>& objects = nearest.objects;
+	objects.clear();
+	for (uint32_t object = 0; object < gameObjectBounds.Size(); object++)
+	{
+		if (acceptObject(object))
+		{
+			objects.push_back({ object, ObjectDistanceSquared(searchBox, object) });
+		}
+	}
+	size_t count = std::min<size_t>(k, objects.size());
+	std::partial_sort(objects.begin(), objects.begin() + count, objects.end(), CloserThan);
+	objects.resize(count);
+}
+
+// Used by FindNearestObject, walks the subtree under startNode closest child first and updates closest with every closer object
+template <typename Filter>
+void FindNearestObjectFromNode(FloatRect searchBox, uint32_t startNode, Filter& acceptObject, NearestObject& closest)
+{
+	uint32_t stackNodes[TRAVERSAL_STACK_SIZE];
+	float stackDistances[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+
+	uint32_t currentNode = startNode;
+	float distanceSquared = NodeDistanceSquared(searchBox, bvh[currentNode]);
+
+	while (true)
+	{
+		if (distanceSquared <= closest.distanceSquared)
+		{
+			const Node& node = bvh[currentNode];
+			if (!node.IsLeaf())
+			{
+				uint32_t nearNode = currentNode + 1;
+				uint32_t farNode = node.childB;
+				float nearDistance = NodeDistanceSquared(searchBox, bvh[nearNode]);
+				float farDistance = NodeDistanceSquared(searchBox, bvh[farNode]);
+				if (farDistance < nearDistance)
+				{
+					std::swap(nearNode, farNode);
+					std::swap(nearDistance, farDistance);
+				}
+
+				if (farDistance <= closest.distanceSquared)
+				{
+					if (stackSize == TRAVERSAL_STACK_SIZE)
+					{
+						FindNearestObjectFromNode(searchBox, farNode, acceptObject, closest);
+					}
+					else
+					{
+						stackNodes[stackSize] = farNode;
+						stackDistances[stackSize] = farDistance;
+						stackSize++;
+					}
+				}
+				currentNode = nearNode;
+				distanceSquared = nearDistance;
+				continue;
+			}
+
+			for (uint32_t i = node.firstObject; i < node.firstObject + node.objectCount; i++)
+			{
+				NearestObject candidate{ bvhObjects[i], ObjectDistanceSquared(searchBox, bvhObjects[i]) };
+				if (CloserThan(candidate, closest) && acceptObject(candidate.object))
+				{
+					closest = candidate;
+				}
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			return;
+		}
+		stackSize--;
+		currentNode = stackNodes[stackSize];
+		distanceSquared = stackDistances[stackSize];
+	}
+}
+
+/* Same result as FindNearestObjects with k = 1, but walks depth first on the fixed size stack so it needs no scratch space.
+ * object is NULL_OBJECT when no object was accepted.
+ */
+template <typename Filter = AcceptAllObjects>
+NearestObject FindNearestObject(FloatRect searchBox, Filter&& acceptObject = Filter())
+{
+	NearestObject closest;
+	if (!bvh.empty())
+	{
+		FindNearestObjectFromNode(searchBox, 0, acceptObject, closest);
+	}
+	return closest;
+}
+
+/* Batched queries ------------------------------------------------------------------------------------------------------------------
+ * Runs many search boxes at once, split into blocks that are spread over the thread pool.
+ * Every block collects its hits into its own buffer, which are then copied into one flat list.
+ */
+constexpr uint32_t BATCH_QUERY_BLOCK_SIZE = 256;
+
+struct BatchQueryResults {
+	// Objects hit by query i are objects[offsets[i]] up to objects[offsets[i + 1]]
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> objects;
+
+	// Per block buffers, kept so repeated batches of a similar size do not allocate
+	std::vector<std::vector<uint32_t>> blockObjects;
+	std::vector<uint32_t> blockOffsets;
+};
+
+extern ThreadPool threadPool;
+
+void QueryBVHBatch(const FloatRect* queries, uint32_t queryCount, BatchQueryResults& results);
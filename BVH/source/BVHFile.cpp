@@ -0,0 +1,146 @@
+#include "BVHFile.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Saving ---------------------------------------------------------------------------------------------------------------------------
+
+uint64_t AlignSectionOffset(uint64_t offset)
+{
+	return (offset + BVH_FILE_SECTION_ALIGNMENT - 1) & ~(BVH_FILE_SECTION_ALIGNMENT - 1);
+}
+
+// Pads the file up to offset, then writes the section
+bool WriteSection(std::FILE* file, uint64_t& written, uint64_t offset, const void* section, uint64_t size)
+{
+	static const char padding[BVH_FILE_SECTION_ALIGNMENT] = {};
+	if (offset - written > 0 && std::fwrite(padding, 1, offset - written, file) != offset - written)
+	{
+		return false;
+	}
+	if (size > 0 && std::fwrite(section, 1, size, file) != size)
+	{
+		return false;
+	}
+	written = offset + size;
+	return true;
+}
+
+bool SaveBVH(const char* path)
+{
+	BVHFileHeader header;
+	std::memcpy(header.magic, BVH_FILE_MAGIC, sizeof(header.magic));
+	header.version = BVH_FILE_VERSION;
+	header.byteOrder = BVH_FILE_BYTE_ORDER;
+	header.nodeSize = sizeof(Node);
+	header.nodeCount = static_cast<uint32_t>(bvh.size());
+	header.objectCount = gameObjectBounds.Size();
+	header.reserved = 0;
+
+	uint64_t nodesSize = static_cast<uint64_t>(header.nodeCount) * sizeof(Node);
+	uint64_t boundsSize = static_cast<uint64_t>(header.objectCount) * sizeof(float);
+	uint64_t objectsSize = static_cast<uint64_t>(header.objectCount) * sizeof(uint32_t);
+	header.nodesOffset = AlignSectionOffset(sizeof(BVHFileHeader));
+	header.objectsOffset = AlignSectionOffset(header.nodesOffset + nodesSize);
+	header.minXOffset = AlignSectionOffset(header.objectsOffset + objectsSize);
+	header.minYOffset = AlignSectionOffset(header.minXOffset + boundsSize);
+	header.maxXOffset = AlignSectionOffset(header.minYOffset + boundsSize);
+	header.maxYOffset = AlignSectionOffset(header.maxXOffset + boundsSize);
+	header.fileSize = header.maxYOffset + boundsSize;
+
+	// The bvh has to have been built over the current objects
+	if (bvhObjects.size() != header.objectCount)
+	{
+		return false;
+	}
+
+	std::FILE* file = std::fopen(path, "wb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	uint64_t written = 0;
+	bool succeeded = WriteSection(file, written, 0, &header, sizeof(BVHFileHeader)) &&
+		WriteSection(file, written, header.nodesOffset, bvh.data(), nodesSize) &&
+		WriteSection(file, written, header.objectsOffset, bvhObjects.data(), objectsSize) &&
+		WriteSection(file, written, header.minXOffset, gameObjectBounds.minX.data(), boundsSize) &&
+		WriteSection(file, written, header.minYOffset, gameObjectBounds.minY.data(), boundsSize) &&
+		WriteSection(file, written, header.maxXOffset, gameObjectBounds.maxX.data(), boundsSize) &&
+		WriteSection(file, written, header.maxYOffset, gameObjectBounds.maxY.data(), boundsSize);
+
+	if (std::fclose(file) != 0)
+	{
+		succeeded = false;
+	}
+	if (!succeeded)
+	{
+		std::remove(path);
+	}
+	return succeeded;
+}
+
+// Mapping --------------------------------------------------------------------------------------------------------------------------
+
+// A section has to be aligned and lie entirely within the file
+bool SectionFits(const BVHFileHeader& header, uint64_t offset, uint64_t size)
+{
+	return offset % BVH_FILE_SECTION_ALIGNMENT == 0 && offset >= sizeof(BVHFileHeader) &&
+		offset <= header.fileSize && size <= header.fileSize - offset;
+}
+
+bool HeaderIsValid(const BVHFileHeader& header, size_t mappedSize)
+{
+	if (std::memcmp(header.magic, BVH_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != BVH_FILE_VERSION ||
+			header.byteOrder != BVH_FILE_BYTE_ORDER ||
+			header.nodeSize != sizeof(Node) ||
+			header.fileSize != mappedSize)
+	{
+		return false;
+	}
+
+	uint64_t nodesSize = static_cast<uint64_t>(header.nodeCount) * sizeof(Node);
+	uint64_t boundsSize = static_cast<uint64_t>(header.objectCount) * sizeof(float);
+	uint64_t objectsSize = static_cast<uint64_t>(header.objectCount) * sizeof(uint32_t);
+	return SectionFits(header, header.nodesOffset, nodesSize) &&
+		SectionFits(header, header.objectsOffset, objectsSize) &&
+		SectionFits(header, header.minXOffset, boundsSize) &&
+		SectionFits(header, header.minYOffset, boundsSize) &&
+		SectionFits(header, header.maxXOffset, boundsSize) &&
+		SectionFits(header, header.maxYOffset, boundsSize);
+}
+
+bool MappedBVH::Open(const char* path)
+{
+	Close();
+	if (!file.Open(path) || file.Size() < sizeof(BVHFileHeader))
+	{
+		Close();
+		return false;
+	}
+
+	const unsigned char* data = file.Data();
+	const BVHFileHeader& header = *reinterpret_cast<const BVHFileHeader*>(data);
+	if (!HeaderIsValid(header, file.Size()))
+	{
+		Close();
+		return false;
+	}
+
+	view.nodes = reinterpret_cast<const Node*>(data + header.nodesOffset);
+	view.nodeCount = header.nodeCount;
+	view.objects = reinterpret_cast<const uint32_t*>(data + header.objectsOffset);
+	view.minX = reinterpret_cast<const float*>(data + header.minXOffset);
+	view.minY = reinterpret_cast<const float*>(data + header.minYOffset);
+	view.maxX = reinterpret_cast<const float*>(data + header.maxXOffset);
+	view.maxY = reinterpret_cast<const float*>(data + header.maxYOffset);
+	view.objectCount = header.objectCount;
+	return true;
+}
+
+void MappedBVH::Close()
+{
+	file.Close();
+	view = BVHView();
+}
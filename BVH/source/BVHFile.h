@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "BVH.h"
+#include "MappedFile.h"
+
+/* BVH files ------------------------------------------------------------------------------------------------------------------------
+ * A built bvh saved as one binary file that is queried straight from a memory mapping, without parsing or copying anything.
+ * Static scenes then only need building once, later launches map the file and can query it straight away.
+ *
+ * The file is a header followed by sections, each starting on a SECTION_ALIGNMENT boundary:
+ * the nodes exactly as they are laid out in memory, the object indices in bvh order, then minX, minY, maxX and maxY by object index.
+ * Nodes only refer to each other and to objects by index and sections are found by their offset from the start of the file,
+ * so the file works wherever it is mapped.
+ */
+
+constexpr uint32_t BVH_FILE_VERSION = 1;
+
+// Marks a bvh file, and catches files written on a machine of the other byte order
+constexpr char BVH_FILE_MAGIC[8] = { 'B', 'V', 'H', 'F', 'I', 'L', 'E', '\0' };
+constexpr uint32_t BVH_FILE_BYTE_ORDER = 0x01020304;
+
+constexpr uint64_t BVH_FILE_SECTION_ALIGNMENT = 64;
+
+// Nodes are mapped as they are, so their layout is part of the format
+static_assert(std::is_trivially_copyable<Node>::value && std::is_standard_layout<Node>::value, "Node is written to file as raw bytes");
+static_assert(sizeof(Node) == 32, "Changing the layout of Node needs a new BVH_FILE_VERSION");
+
+struct BVHFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t nodeSize;
+	uint32_t nodeCount;
+	uint32_t objectCount;
+	uint32_t reserved;
+
+	// Byte offsets from the start of the file
+	uint64_t nodesOffset;
+	uint64_t objectsOffset;
+	uint64_t minXOffset;
+	uint64_t minYOffset;
+	uint64_t maxXOffset;
+	uint64_t maxYOffset;
+	uint64_t fileSize;
+};
+
+// Writes the current bvh and object bounds, CreateBVH has to be called first. Returns false if the file could not be written
+bool SaveBVH(const char* path);
+
+/* A read only mapping of a bvh file, queried in place through View().
+ * Only the header is checked when opening, the nodes are trusted to be as SaveBVH wrote them.
+ * Pages are loaded by the OS as queries touch them, so opening costs the same for any size of file.
+ */
+struct MappedBVH {
+	// Closes any file already open. Returns false if the file is missing, not a bvh file, or of another version
+	bool Open(const char* path);
+	void Close();
+
+	bool IsOpen() const
+	{
+		return file.IsOpen();
+	}
+
+	const BVHView& View() const
+	{
+		return view;
+	}
+
+private:
+	BVHView view;
+	MappedFile file;
+};
+
+template <typename Callback>
+void QueryMappedBVH(const MappedBVH& mappedBVH, FloatRect searchRect, Callback&& onObjectHit)
+{
+	QueryBVHView(mappedBVH.View(), searchRect, onObjectHit);
+}
@@ -0,0 +1,113 @@
+#include "BackgroundBVH.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+/* Trees whose readers have all let go, waiting to be built into again.
+ * Defined before publishedSnapshot so they outlive it when the program exits, as releasing the last tree adds to them.
+ */
+std::mutex retiredSnapshotsMutex;
+std::vector<std::unique_ptr<BVHSnapshot>> retiredSnapshots;
+
+// Only ever read and replaced through std::atomic_load and std::atomic_store
+std::shared_ptr<const BVHSnapshot> publishedSnapshot;
+
+std::atomic<bool> rebuildRunning{ false };
+
+// Joins the last rebuild's thread when the program exits, in case it is still going
+struct RebuildThread {
+	~RebuildThread()
+	{
+		Join();
+	}
+
+	void Join()
+	{
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+	}
+
+	std::thread thread;
+};
+RebuildThread rebuildThread;
+
+// Deleter of published trees, keeps the tree for a later rebuild rather than freeing it
+void RetireSnapshot(const BVHSnapshot* snapshot)
+{
+	std::lock_guard<std::mutex> lock(retiredSnapshotsMutex);
+	retiredSnapshots.emplace_back(const_cast<BVHSnapshot*>(snapshot));
+}
+
+std::unique_ptr<BVHSnapshot> TakeRetiredSnapshot()
+{
+	std::lock_guard<std::mutex> lock(retiredSnapshotsMutex);
+	if (retiredSnapshots.empty())
+	{
+		return std::unique_ptr<BVHSnapshot>(new BVHSnapshot());
+	}
+	std::unique_ptr<BVHSnapshot> snapshot = std::move(retiredSnapshots.back());
+	retiredSnapshots.pop_back();
+	return snapshot;
+}
+
+// Runs on the rebuild's own thread
+void RebuildIntoSnapshot(BVHSnapshot* snapshot, BuildMode buildMode, uint32_t maxLeafObjects)
+{
+	// Built straight into the snapshot, the global bvh is never touched
+	snapshot->buildTimeInMs = CreateBVHFromBounds(snapshot->bounds, snapshot->nodes, snapshot->objects, snapshot->objectLeafNodes,
+		buildMode, false, maxLeafObjects);
+
+	BVHView& view = snapshot->view;
+	view.nodes = snapshot->nodes.data();
+	view.nodeCount = static_cast<uint32_t>(snapshot->nodes.size());
+	view.objects = snapshot->objects.data();
+	view.minX = snapshot->bounds.minX.data();
+	view.minY = snapshot->bounds.minY.data();
+	view.maxX = snapshot->bounds.maxX.data();
+	view.maxY = snapshot->bounds.maxY.data();
+	view.objectCount = snapshot->bounds.Size();
+
+	std::atomic_store(&publishedSnapshot, std::shared_ptr<const BVHSnapshot>(snapshot, RetireSnapshot));
+	rebuildRunning.store(false);
+}
+
+bool StartBVHRebuild(BuildMode buildMode, uint32_t maxLeafObjects)
+{
+	if (rebuildRunning.load())
+	{
+		return false;
+	}
+	// The last rebuild has published, so its thread is done or about to be
+	rebuildThread.Join();
+
+	std::unique_ptr<BVHSnapshot> snapshot = TakeRetiredSnapshot();
+	snapshot->bounds = gameObjectBounds;
+
+	rebuildRunning.store(true);
+	rebuildThread.thread = std::thread(RebuildIntoSnapshot, snapshot.release(), buildMode, maxLeafObjects);
+	return true;
+}
+
+bool BVHRebuildRunning()
+{
+	return rebuildRunning.load();
+}
+
+void WaitForBVHRebuild()
+{
+	rebuildThread.Join();
+}
+
+std::shared_ptr<const BVHSnapshot> AcquireBVHSnapshot()
+{
+	std::shared_ptr<const BVHSnapshot> snapshot = std::atomic_load(&publishedSnapshot);
+	if (snapshot == nullptr)
+	{
+		static const std::shared_ptr<const BVHSnapshot> emptySnapshot = std::make_shared<BVHSnapshot>();
+		return emptySnapshot;
+	}
+	return snapshot;
+}
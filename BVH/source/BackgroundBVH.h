@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "BVH.h"
+
+/* Background rebuilds --------------------------------------------------------------------------------------------------------------
+ * Builds a new tree on a thread of its own while queries keep running against the last finished one, so a rebuild
+ * no longer stalls the frame that asks for it. The tree is built from a copy of gameObjectBounds taken when the rebuild starts,
+ * and replaces the published tree in one atomic swap as soon as it is done.
+ *
+ * Readers hold the tree they acquired for as long as they use it, a tree that has been replaced is only reclaimed
+ * once the last of its readers lets go. Its memory is then kept for a later rebuild, so rebuilding a scene of a steady size
+ * settles into reusing the same two or three trees.
+ *
+ * Rebuilds never touch bvh or the other globals behind it, so QueryBVH and RefitBVH carry on working on the tree CreateBVH last built.
+ * The build scratch space is shared though, so CreateBVH, BVHMemoryInBytes and ReleaseBVHMemory block while a rebuild is building.
+ * gameObjectBounds is the game's to change meanwhile, changes show up in the published tree after the next rebuild.
+ */
+
+// A finished tree along with the bounds it was built from, never changed once published
+struct BVHSnapshot {
+	std::vector<Node> nodes;
+	std::vector<uint32_t> objects;
+	// Leaf holding each object, as objectLeafNodes is for bvh
+	std::vector<uint32_t> objectLeafNodes;
+	GameObjectBounds bounds;
+	BVHView view;
+	float buildTimeInMs = 0.0f;
+};
+
+/* Copies gameObjectBounds and starts building from the copy, returns false without starting anything if a rebuild is still running.
+ * The build is single threaded, leaving the thread pool to the game.
+ * Start and wait for rebuilds from one thread, the one that owns gameObjectBounds.
+ */
+bool StartBVHRebuild(BuildMode buildMode = BuildMode::BinnedSurfaceAreaHeuristic, uint32_t maxLeafObjects = 2);
+
+bool BVHRebuildRunning();
+
+// Blocks until the running rebuild, if any, has published its tree
+void WaitForBVHRebuild();
+
+// The last tree a rebuild published, or an empty one before the first has finished. Safe to call from any thread
+std::shared_ptr<const BVHSnapshot> AcquireBVHSnapshot();
+
+template <typename Callback>
+void QueryBVHSnapshot(const BVHSnapshot& snapshot, FloatRect searchRect, Callback&& onObjectHit)
+{
+	QueryBVHView(snapshot.view, searchRect, onObjectHit);
+}
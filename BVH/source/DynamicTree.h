@@ -0,0 +1,325 @@
+#pragma once
+
+#include "BVH.h"
+
+/* Dynamic tree --------------------------------------------------------------------------------------------------------------------
+ * Separate tree for objects that come and go, in the style of the dynamic trees used by 2D physics engines.
+ * Objects are inserted and removed one at a time in O(log n), without rebuilding anything.
+ * Insertion walks down to the cheapest sibling by perimeter, and rotations keep the tree height balanced.
+ */
+
+struct DynamicNode {
+	bool IsLeaf() const
+	{
+		return childA == NULL_NODE;
+	}
+
+	FloatRect boundingBox;
+	// Parent node, or the next free node while the node is unused
+	uint32_t parent = NULL_NODE;
+	uint32_t childA = NULL_NODE;
+	uint32_t childB = NULL_NODE;
+	// Object held by a leaf node
+	uint32_t object = NULL_NODE;
+	// Leaves are 0, unused nodes are -1
+	int32_t height = -1;
+};
+
+struct DynamicTree {
+	// Adds an object and returns the leaf holding it, which is used to remove it again
+	uint32_t Insert(uint32_t object, FloatRect boundingBox)
+	{
+		uint32_t leaf = AllocateNode();
+		nodes[leaf].boundingBox = boundingBox;
+		nodes[leaf].object = object;
+		nodes[leaf].height = 0;
+		InsertLeaf(leaf);
+		objectCount++;
+		return leaf;
+	}
+
+	void Remove(uint32_t leaf)
+	{
+		RemoveLeaf(leaf);
+		FreeNode(leaf);
+		objectCount--;
+	}
+
+	// Moves an object by taking its leaf out and inserting it again, the leaf index stays the same
+	void Update(uint32_t leaf, FloatRect boundingBox)
+	{
+		RemoveLeaf(leaf);
+		nodes[leaf].boundingBox = boundingBox;
+		InsertLeaf(leaf);
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		root = NULL_NODE;
+		freeList = NULL_NODE;
+		objectCount = 0;
+	}
+
+	// Calls onObjectHit(object) for every object colliding with searchRect
+	template <typename Callback>
+	void Query(FloatRect searchRect, Callback&& onObjectHit, uint32_t startNode = NULL_NODE) const
+	{
+		uint32_t stack[TRAVERSAL_STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = startNode == NULL_NODE ? root : startNode;
+
+		while (stackSize > 0)
+		{
+			uint32_t currentNode = stack[--stackSize];
+			if (currentNode == NULL_NODE)
+			{
+				continue;
+			}
+
+			const DynamicNode& node = nodes[currentNode];
+			if (!BoxBoxCollision(searchRect, node.boundingBox))
+			{
+				continue;
+			}
+			if (node.IsLeaf())
+			{
+				onObjectHit(node.object);
+				continue;
+			}
+
+			// The tree is height balanced, so running out of stack only happens with huge trees
+			if (stackSize + 2 > TRAVERSAL_STACK_SIZE)
+			{
+				Query(searchRect, onObjectHit, node.childB);
+			}
+			else
+			{
+				stack[stackSize++] = node.childB;
+			}
+			stack[stackSize++] = node.childA;
+		}
+	}
+
+	std::vector<DynamicNode> nodes;
+	uint32_t root = NULL_NODE;
+	uint32_t freeList = NULL_NODE;
+	uint32_t objectCount = 0;
+
+private:
+	uint32_t AllocateNode()
+	{
+		if (freeList == NULL_NODE)
+		{
+			nodes.emplace_back();
+			return static_cast<uint32_t>(nodes.size() - 1);
+		}
+		uint32_t node = freeList;
+		freeList = nodes[node].parent;
+		nodes[node] = DynamicNode();
+		return node;
+	}
+
+	void FreeNode(uint32_t node)
+	{
+		nodes[node].parent = freeList;
+		nodes[node].height = -1;
+		freeList = node;
+	}
+
+	void InsertLeaf(uint32_t leaf)
+	{
+		if (root == NULL_NODE)
+		{
+			root = leaf;
+			nodes[root].parent = NULL_NODE;
+			return;
+		}
+
+		// Find the best sibling, stop descending once making the current node the sibling is cheapest
+		FloatRect leafBox = nodes[leaf].boundingBox;
+		uint32_t sibling = root;
+		while (!nodes[sibling].IsLeaf())
+		{
+			const DynamicNode& node = nodes[sibling];
+			float perimeter = HalfPerimeter(node.boundingBox);
+			float combinedPerimeter = HalfPerimeter(UnionRect(node.boundingBox, leafBox));
+
+			// Cost of creating a new parent for this node and the leaf
+			float cost = 2.0f * combinedPerimeter;
+			// Every node above has to grow as well when descending further
+			float inheritanceCost = 2.0f * (combinedPerimeter - perimeter);
+
+			float costA = DescendCost(node.childA, leafBox) + inheritanceCost;
+			float costB = DescendCost(node.childB, leafBox) + inheritanceCost;
+			if (cost < costA && cost < costB)
+			{
+				break;
+			}
+			sibling = costA < costB ? node.childA : node.childB;
+		}
+
+		// Create a new parent holding the sibling and the leaf
+		uint32_t oldParent = nodes[sibling].parent;
+		uint32_t newParent = AllocateNode();
+		nodes[newParent].parent = oldParent;
+		nodes[newParent].boundingBox = UnionRect(leafBox, nodes[sibling].boundingBox);
+		nodes[newParent].height = nodes[sibling].height + 1;
+		nodes[newParent].childA = sibling;
+		nodes[newParent].childB = leaf;
+		nodes[sibling].parent = newParent;
+		nodes[leaf].parent = newParent;
+
+		if (oldParent == NULL_NODE)
+		{
+			root = newParent;
+		}
+		else if (nodes[oldParent].childA == sibling)
+		{
+			nodes[oldParent].childA = newParent;
+		}
+		else
+		{
+			nodes[oldParent].childB = newParent;
+		}
+
+		FixUpwards(nodes[leaf].parent);
+	}
+
+	void RemoveLeaf(uint32_t leaf)
+	{
+		if (leaf == root)
+		{
+			root = NULL_NODE;
+			return;
+		}
+
+		// The sibling takes the place of the parent
+		uint32_t parent = nodes[leaf].parent;
+		uint32_t grandParent = nodes[parent].parent;
+		uint32_t sibling = nodes[parent].childA == leaf ? nodes[parent].childB : nodes[parent].childA;
+		FreeNode(parent);
+
+		nodes[sibling].parent = grandParent;
+		if (grandParent == NULL_NODE)
+		{
+			root = sibling;
+			return;
+		}
+		if (nodes[grandParent].childA == parent)
+		{
+			nodes[grandParent].childA = sibling;
+		}
+		else
+		{
+			nodes[grandParent].childB = sibling;
+		}
+		FixUpwards(grandParent);
+	}
+
+	// Extra perimeter added by inserting the leaf somewhere below child
+	float DescendCost(uint32_t child, const FloatRect& leafBox) const
+	{
+		FloatRect combined = UnionRect(leafBox, nodes[child].boundingBox);
+		if (nodes[child].IsLeaf())
+		{
+			return HalfPerimeter(combined);
+		}
+		return HalfPerimeter(combined) - HalfPerimeter(nodes[child].boundingBox);
+	}
+
+	// Walks up to the root, balancing and recalculating heights and bounds
+	void FixUpwards(uint32_t currentNode)
+	{
+		while (currentNode != NULL_NODE)
+		{
+			currentNode = Balance(currentNode);
+
+			DynamicNode& node = nodes[currentNode];
+			node.height = 1 + std::max(nodes[node.childA].height, nodes[node.childB].height);
+			node.boundingBox = UnionRect(nodes[node.childA].boundingBox, nodes[node.childB].boundingBox);
+
+			currentNode = node.parent;
+		}
+	}
+
+	/* Rotates the taller child up if the two children differ in height by more than one.
+	 * Returns the node now sitting where nodeA was.
+	 *
+	 *         A
+	 *       /   \
+	 *      B     C
+	 *           / \
+	 *          F   G
+	 */
+	uint32_t Balance(uint32_t nodeA)
+	{
+		DynamicNode& a = nodes[nodeA];
+		if (a.IsLeaf() || a.height < 2)
+		{
+			return nodeA;
+		}
+
+		int32_t balance = nodes[a.childB].height - nodes[a.childA].height;
+		if (balance > 1)
+		{
+			return Rotate(nodeA, a.childB, a.childA);
+		}
+		if (balance < -1)
+		{
+			return Rotate(nodeA, a.childA, a.childB);
+		}
+		return nodeA;
+	}
+
+	// Swaps nodeA with its taller child nodeC, the shorter of C's children moves down to A
+	uint32_t Rotate(uint32_t nodeA, uint32_t nodeC, uint32_t nodeB)
+	{
+		DynamicNode& a = nodes[nodeA];
+		DynamicNode& c = nodes[nodeC];
+		uint32_t nodeF = c.childA;
+		uint32_t nodeG = c.childB;
+
+		// C takes the place of A
+		c.childA = nodeA;
+		c.parent = a.parent;
+		a.parent = nodeC;
+		if (c.parent == NULL_NODE)
+		{
+			root = nodeC;
+		}
+		else if (nodes[c.parent].childA == nodeA)
+		{
+			nodes[c.parent].childA = nodeC;
+		}
+		else
+		{
+			nodes[c.parent].childB = nodeC;
+		}
+
+		// The taller of F and G stays with C, the other replaces C under A
+		uint32_t keep = nodeF;
+		uint32_t move = nodeG;
+		if (nodes[nodeF].height < nodes[nodeG].height)
+		{
+			keep = nodeG;
+			move = nodeF;
+		}
+		c.childB = keep;
+		if (a.childA == nodeC)
+		{
+			a.childA = move;
+		}
+		else
+		{
+			a.childB = move;
+		}
+		nodes[move].parent = nodeA;
+
+		a.boundingBox = UnionRect(nodes[nodeB].boundingBox, nodes[move].boundingBox);
+		a.height = 1 + std::max(nodes[nodeB].height, nodes[move].height);
+		c.boundingBox = UnionRect(a.boundingBox, nodes[keep].boundingBox);
+		c.height = 1 + std::max(a.height, nodes[keep].height);
+		return nodeC;
+	}
+};
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "BVH.h"
+
+/* Generic BVH ----------------------------------------------------------------------------------------------------------------------
+ * Header only binned SAH tree, templated on the number of dimensions, the scalar type and how the bounds of a primitive are read.
+ * The same broadphase can then run over a 2D float game layer, a 3D double simulation or integer grid coordinates.
+ * Every loop over the axes has a compile time length, so each instantiation compiles down to straight line code for its
+ * own dimension and type.
+ *
+ * The layout is the same as bvh: depth first, childA directly after its parent and only childB stored.
+ * Queries walk it with TraverseNodes, the same loop QueryBVH runs on.
+ * The global bvh is still the home of refitting, the 4-wide and quantized layouts, BVH files, ray casts and nearest queries.
+ * Its binned build splits nodes with the same binning, sweep and partition as this tree, see Binned SAH below.
+ */
+
+template <int Dimensions, typename Scalar>
+struct Box {
+	static_assert(Dimensions > 0, "A box needs at least one axis");
+
+	Scalar min[Dimensions];
+	Scalar max[Dimensions];
+
+	// A box that anything grown into it replaces
+	static Box Empty()
+	{
+		Box box;
+		for (int axis = 0; axis < Dimensions; axis++)
+		{
+			box.min[axis] = std::numeric_limits<Scalar>::max();
+			box.max[axis] = std::numeric_limits<Scalar>::lowest();
+		}
+		return box;
+	}
+
+	void Grow(const Box& other)
+	{
+		for (int axis = 0; axis < Dimensions; axis++)
+		{
+			// Written out rather than with std::min and std::max, which compile to branches here and mispredict on every other object
+			min[axis] = other.min[axis] < min[axis] ? other.min[axis] : min[axis];
+			max[axis] = other.max[axis] > max[axis] ? other.max[axis] : max[axis];
+		}
+	}
+};
+
+// Same strict test as BoxBoxCollision, boxes that only touch do not collide
+template <int Dimensions, typename Scalar>
+inline bool BoxesCollide(const Box<Dimensions, Scalar>& boxA, const Box<Dimensions, Scalar>& boxB)
+{
+	bool collided = true;
+	for (int axis = 0; axis < Dimensions; axis++)
+	{
+		collided &= (boxA.min[axis] < boxB.max[axis]) & (boxA.max[axis] > boxB.min[axis]);
+	}
+	return collided;
+}
+
+// Reads the objects of gameObjectBounds, for running the generic tree over the same scene as bvh
+struct GameObjectBoundsAccessor {
+	Box<2, float> operator()(uint32_t object) const
+	{
+		return { { gameObjectBounds.minX[object], gameObjectBounds.minY[object] }, { gameObjectBounds.maxX[object], gameObjectBounds.maxY[object] } };
+	}
+};
+
+/* Binned SAH -----------------------------------------------------------------------------------------------------------------------
+ * Rather than sorting every node, box centres are dropped into a fixed number of bins along every axis
+ * and only the planes between bins are costed, which makes each split O(n) instead of O(n log n).
+ * GenericBVH and the binned build of bvh in BVH.cpp both split their nodes with these, the build of bvh
+ * accumulating the bins of large nodes as parallel tasks. Real is the type centres and costs are worked out in.
+ */
+constexpr uint32_t MAX_SAH_BINS = 32;
+
+// Nodes smaller than this use half the bins, few objects gain little from the extra planes
+constexpr uint32_t SAH_FULL_BINS_CUTOFF = 4096;
+
+inline uint32_t SAHBinCount(uint32_t objectCount)
+{
+	return objectCount >= SAH_FULL_BINS_CUTOFF ? MAX_SAH_BINS : MAX_SAH_BINS / 2;
+}
+
+// Twice the centre of the box on the given axis, which keeps integer centres exact
+template <typename Real, int Dimensions, typename Scalar>
+inline Real BoxCentre(const Box<Dimensions, Scalar>& box, int axis)
+{
+	return static_cast<Real>(box.min[axis]) + static_cast<Real>(box.max[axis]);
+}
+
+// Half the surface of the box: its perimeter in 2D, half its surface area in 3D
+template <typename Real, int Dimensions, typename Scalar>
+inline Real HalfSurface(const Box<Dimensions, Scalar>& box)
+{
+	Real surface = 0;
+	for (int skipped = 0; skipped < Dimensions; skipped++)
+	{
+		Real face = 1;
+		for (int axis = 0; axis < Dimensions; axis++)
+		{
+			face *= axis == skipped ? Real(1) : static_cast<Real>(box.max[axis]) - static_cast<Real>(box.min[axis]);
+		}
+		surface += face;
+	}
+	return surface;
+}
+
+// Bounds and count of the boxes dropped into one bin
+template <int Dimensions, typename Scalar, typename Real>
+struct SAHBin {
+	Box<Dimensions, Scalar> bounds = Box<Dimensions, Scalar>::Empty();
+	uint32_t objectCount = 0;
+
+	void Grow(const Box<Dimensions, Scalar>& box)
+	{
+		bounds.Grow(box);
+		objectCount++;
+	}
+
+	void Grow(const SAHBin& other)
+	{
+		bounds.Grow(other.bounds);
+		objectCount += other.objectCount;
+	}
+
+	Real Cost() const
+	{
+		return objectCount ? HalfSurface<Real>(bounds) * objectCount : Real(0);
+	}
+};
+
+// Maps the centres of a node's boxes onto its bins, both the binning and the partition use this so they always agree
+template <int Dimensions, typename Real>
+struct SAHBinning {
+	// Spreads binCount bins evenly from the smallest to the largest centre on each axis
+	SAHBinning(const Real (&centreMin)[Dimensions], const Real (&centreMax)[Dimensions], uint32_t _binCount) : binCount(_binCount)
+	{
+		for (int axis = 0; axis < Dimensions; axis++)
+		{
+			Real extent = centreMax[axis] - centreMin[axis];
+			centreStart[axis] = centreMin[axis];
+			binScale[axis] = extent > 0 ? binCount / extent : Real(0);
+		}
+	}
+
+	template <typename Scalar>
+	uint32_t BinIndex(const Box<Dimensions, Scalar>& box, int axis) const
+	{
+		// Branch free for the same reason as Box::Grow
+		Real bin = (BoxCentre<Real>(box, axis) - centreStart[axis]) * binScale[axis];
+		uint32_t binIndex = static_cast<uint32_t>(bin > Real(0) ? bin : Real(0));
+		return binIndex < binCount - 1 ? binIndex : binCount - 1;
+	}
+
+	Real centreStart[Dimensions];
+	Real binScale[Dimensions];
+	uint32_t binCount = 0;
+};
+
+// The plane before bin on axis, an axis of -1 means no plane separates the boxes
+struct SAHPlane {
+	int axis = -1;
+	uint32_t bin = 0;
+};
+
+// Costs every plane between bins on every axis and returns the cheapest, both sides must hold at least one of the objectCount boxes
+template <int Dimensions, typename Scalar, typename Real>
+SAHPlane FindCheapestSAHPlane(const SAHBin<Dimensions, Scalar, Real> (&bins)[Dimensions][MAX_SAH_BINS], uint32_t binCount, uint32_t objectCount)
+{
+	// The right side of plane i starts at bin i
+	Real bestCost = std::numeric_limits<Real>::max();
+	SAHPlane bestPlane;
+	for (int axis = 0; axis < Dimensions; axis++)
+	{
+		Real rightCosts[MAX_SAH_BINS];
+		SAHBin<Dimensions, Scalar, Real> right;
+		for (uint32_t bin = binCount; bin-- > 1;)
+		{
+			right.Grow(bins[axis][bin]);
+			rightCosts[bin] = right.Cost();
+		}
+
+		SAHBin<Dimensions, Scalar, Real> left;
+		for (uint32_t bin = 1; bin < binCount; bin++)
+		{
+			left.Grow(bins[axis][bin - 1]);
+			if (left.objectCount == 0 || left.objectCount == objectCount)
+			{
+				continue;
+			}
+			Real cost = left.Cost() + rightCosts[bin];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestPlane.axis = axis;
+				bestPlane.bin = bin;
+			}
+		}
+	}
+	return bestPlane;
+}
+
+// Partitions objects and their boxes together on the plane, swapping objects from the wrong side, and returns the number left of it
+template <int Dimensions, typename Scalar, typename Real>
+uint32_t PartitionOnSAHPlane(const SAHBinning<Dimensions, Real>& binning, SAHPlane plane, uint32_t* objects, Box<Dimensions, Scalar>* boxes, uint32_t objectCount)
+{
+	uint32_t left = 0;
+	uint32_t right = objectCount;
+	while (true)
+	{
+		while (left < right && binning.BinIndex(boxes[left], plane.axis) < plane.bin)
+		{
+			left++;
+		}
+		while (left < right && binning.BinIndex(boxes[right - 1], plane.axis) >= plane.bin)
+		{
+			right--;
+		}
+		if (left >= right)
+		{
+			break;
+		}
+		std::swap(objects[left], objects[right - 1]);
+		std::swap(boxes[left], boxes[right - 1]);
+		left++;
+		right--;
+	}
+	return left;
+}
+
+/* PrimitiveAccessor is called as accessor(primitiveIndex) and returns the Box<Dimensions, Scalar> of that primitive.
+ * It is only called while building, the tree keeps its own copy of every box in tree order for the queries.
+ */
+template <int Dimensions, typename Scalar, typename PrimitiveAccessor>
+struct GenericBVH {
+	using BoxType = Box<Dimensions, Scalar>;
+	// Costs and bin positions of integer trees are worked out in double, so large coordinates cannot overflow
+	using Real = typename std::conditional<std::is_same<Scalar, float>::value, float, double>::type;
+
+	struct Node {
+		bool IsLeaf() const
+		{
+			return childB == NULL_NODE;
+		}
+
+		BoxType bounds;
+		uint32_t childB = NULL_NODE;
+		uint32_t firstObject = 0;
+		uint32_t objectCount = 0;
+	};
+
+	GenericBVH() = default;
+	explicit GenericBVH(PrimitiveAccessor _accessor) : accessor(_accessor) {}
+
+	// Builds over primitives 0 to primitiveCount - 1, nodes holding maxLeafObjects or fewer become leaves
+	void Build(uint32_t primitiveCount, uint32_t maxLeafObjects = 2)
+	{
+		nodes.clear();
+		objects.resize(primitiveCount);
+		objectBounds.resize(primitiveCount);
+		for (uint32_t primitive = 0; primitive < primitiveCount; primitive++)
+		{
+			objects[primitive] = primitive;
+			objectBounds[primitive] = accessor(primitive);
+		}
+
+		buildMaxLeafObjects = std::max(maxLeafObjects, 1u);
+		// A binary tree over n leaves has at most 2n - 1 nodes
+		nodes.reserve(primitiveCount > 0 ? 2 * primitiveCount - 1 : 1);
+		BuildNode(0, primitiveCount);
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		objects.clear();
+		objectBounds.clear();
+	}
+
+	// Calls onObjectHit(primitiveIndex) for every primitive colliding with searchBox, with the same traversal as QueryBVH
+	template <typename Callback>
+	void Query(const BoxType& searchBox, Callback&& onObjectHit, uint32_t startNode = 0) const
+	{
+		auto enterNode = [&searchBox](const Node& node) { return BoxesCollide(searchBox, node.bounds); };
+		auto visitLeaf = [this, &searchBox, &onObjectHit](const Node& node)
+		{
+			for (uint32_t i = node.firstObject; i < node.firstObject + node.objectCount; i++)
+			{
+				if (BoxesCollide(searchBox, objectBounds[i]))
+				{
+					onObjectHit(objects[i]);
+				}
+			}
+		};
+
+		TraverseNodes(nodes.data(), static_cast<uint32_t>(nodes.size()), startNode, enterNode, visitLeaf);
+	}
+
+	PrimitiveAccessor accessor;
+	std::vector<Node> nodes;
+	// Primitive indices in the order the nodes reference them, and the box of each in that same order
+	std::vector<uint32_t> objects;
+	std::vector<BoxType> objectBounds;
+
+private:
+	using Bin = SAHBin<Dimensions, Scalar, Real>;
+
+	// Adds the node for the range and its subtree, returns the node's index
+	uint32_t BuildNode(uint32_t firstObject, uint32_t objectCount)
+	{
+		uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+		nodes.emplace_back();
+
+		BoxType bounds = BoxType::Empty();
+		Real centreMin[Dimensions];
+		Real centreMax[Dimensions];
+		for (int axis = 0; axis < Dimensions; axis++)
+		{
+			centreMin[axis] = std::numeric_limits<Real>::max();
+			centreMax[axis] = std::numeric_limits<Real>::lowest();
+		}
+		for (uint32_t i = firstObject; i < firstObject + objectCount; i++)
+		{
+			bounds.Grow(objectBounds[i]);
+			for (int axis = 0; axis < Dimensions; axis++)
+			{
+				Real centre = BoxCentre<Real>(objectBounds[i], axis);
+				centreMin[axis] = centre < centreMin[axis] ? centre : centreMin[axis];
+				centreMax[axis] = centre > centreMax[axis] ? centre : centreMax[axis];
+			}
+		}
+		nodes[nodeIndex].bounds = bounds;
+		nodes[nodeIndex].firstObject = firstObject;
+		nodes[nodeIndex].objectCount = objectCount;
+
+		if (objectCount <= buildMaxLeafObjects)
+		{
+			return nodeIndex;
+		}
+
+		uint32_t splitCount = FindSplit(firstObject, objectCount, centreMin, centreMax);
+		BuildNode(firstObject, splitCount);
+		uint32_t childB = BuildNode(firstObject + splitCount, objectCount - splitCount);
+		nodes[nodeIndex].childB = childB;
+		return nodeIndex;
+	}
+
+	// Partitions the range on the cheapest plane between bins on any axis, returns the number of objects going to childA
+	uint32_t FindSplit(uint32_t firstObject, uint32_t objectCount, const Real (&centreMin)[Dimensions], const Real (&centreMax)[Dimensions])
+	{
+		SAHBinning<Dimensions, Real> binning(centreMin, centreMax, SAHBinCount(objectCount));
+		Bin bins[Dimensions][MAX_SAH_BINS];
+		for (uint32_t i = firstObject; i < firstObject + objectCount; i++)
+		{
+			for (int axis = 0; axis < Dimensions; axis++)
+			{
+				bins[axis][binning.BinIndex(objectBounds[i], axis)].Grow(objectBounds[i]);
+			}
+		}
+
+		SAHPlane plane = FindCheapestSAHPlane(bins, binning.binCount, objectCount);
+		// Every centre fell into the same bin, so no plane separates them
+		if (plane.axis == -1)
+		{
+			return objectCount / 2;
+		}
+		return PartitionOnSAHPlane(binning, plane, objects.data() + firstObject, objectBounds.data() + firstObject, objectCount);
+	}
+
+	uint32_t buildMaxLeafObjects = 2;
+};
@@ -0,0 +1,103 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const char* path, bool sequential)
+{
+	Close();
+
+#ifdef _WIN32
+	DWORD flags = sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+	HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	file = fileHandle;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart <= 0)
+	{
+		Close();
+		return false;
+	}
+
+	fileMapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (fileMapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	data = static_cast<const unsigned char*>(MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr)
+	{
+		Close();
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int fileDescriptor = open(path, O_RDONLY);
+	if (fileDescriptor < 0)
+	{
+		return false;
+	}
+
+	// The mapping keeps the file alive, so the descriptor can be closed straight away
+	struct stat fileStatus;
+	void* mapping = MAP_FAILED;
+	if (fstat(fileDescriptor, &fileStatus) == 0 && fileStatus.st_size > 0)
+	{
+		mapping = mmap(nullptr, static_cast<size_t>(fileStatus.st_size), PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	}
+	close(fileDescriptor);
+	if (mapping == MAP_FAILED)
+	{
+		return false;
+	}
+	if (sequential)
+	{
+		madvise(mapping, static_cast<size_t>(fileStatus.st_size), MADV_SEQUENTIAL);
+	}
+	data = static_cast<const unsigned char*>(mapping);
+	size = static_cast<size_t>(fileStatus.st_size);
+#endif
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (fileMapping != nullptr)
+	{
+		CloseHandle(fileMapping);
+	}
+	if (file != nullptr)
+	{
+		CloseHandle(file);
+	}
+	file = nullptr;
+	fileMapping = nullptr;
+#else
+	if (data != nullptr)
+	{
+		munmap(const_cast<unsigned char*>(data), size);
+	}
+#endif
+	data = nullptr;
+	size = 0;
+}
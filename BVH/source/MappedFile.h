@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+
+/* A whole file mapped read only into memory, pages are loaded by the OS as they are first touched.
+ * Used by BVH files and binary scene files to read their contents in place.
+ */
+struct MappedFile {
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	// Closes any file already open. sequential hints that the file will be read front to back once. Empty files fail to open
+	bool Open(const char* path, bool sequential = false);
+	void Close();
+
+	bool IsOpen() const
+	{
+		return data != nullptr;
+	}
+
+	const unsigned char* Data() const
+	{
+		return data;
+	}
+
+	size_t Size() const
+	{
+		return size;
+	}
+
+private:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* fileMapping = nullptr;
+#endif
+};
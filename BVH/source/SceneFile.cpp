@@ -0,0 +1,394 @@
+#include "SceneFile.h"
+
+#include <charconv>
+#include <cstring>
+
+// Reading --------------------------------------------------------------------------------------------------------------------------
+
+bool SceneReader::Open(const char* path)
+{
+	Close();
+
+	file = std::fopen(path, "rb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	char magic[sizeof(SCENE_FILE_MAGIC)];
+	if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) || std::memcmp(magic, SCENE_FILE_MAGIC, sizeof(magic)) != 0)
+	{
+		// Not a binary scene, so read it as CSV through the buffer from the top
+		format = SceneFormat::CSV;
+		std::rewind(file);
+		buffer.resize(SCENE_CSV_BUFFER_SIZE);
+		return true;
+	}
+
+	std::fclose(file);
+	file = nullptr;
+	format = SceneFormat::Binary;
+	if (!mappedFile.Open(path, true) || mappedFile.Size() < sizeof(SceneFileHeader))
+	{
+		Close();
+		return false;
+	}
+
+	const SceneFileHeader& header = *reinterpret_cast<const SceneFileHeader*>(mappedFile.Data());
+	uint64_t recordsSize = (mappedFile.Size() - sizeof(SceneFileHeader)) / (4 * sizeof(float));
+	if (header.version != SCENE_FILE_VERSION || header.byteOrder != SCENE_FILE_BYTE_ORDER ||
+			header.objectCount > recordsSize || header.objectCount > UINT32_MAX - gameObjectBounds.Size())
+	{
+		Close();
+		return false;
+	}
+
+	objectCount = header.objectCount;
+	gameObjectBounds.Reserve(gameObjectBounds.Size() + static_cast<uint32_t>(objectCount));
+	return true;
+}
+
+void SceneReader::Close()
+{
+	mappedFile.Close();
+	if (file != nullptr)
+	{
+		std::fclose(file);
+		file = nullptr;
+	}
+	failed = false;
+	errorLine = 0;
+	objectCount = 0;
+	objectsRead = 0;
+	bufferStart = 0;
+	bufferEnd = 0;
+	endOfFile = false;
+	line = 0;
+}
+
+void SceneReader::Fail(uint32_t _errorLine)
+{
+	failed = true;
+	errorLine = _errorLine;
+}
+
+uint32_t SceneReader::ReadChunk(uint32_t maxObjects)
+{
+	if (failed)
+	{
+		return 0;
+	}
+	return format == SceneFormat::Binary ? ReadBinaryChunk(maxObjects) : ReadCSVChunk(maxObjects);
+}
+
+// Records are interleaved in the file, so each chunk is split out into the four bounds arrays
+uint32_t SceneReader::ReadBinaryChunk(uint32_t maxObjects)
+{
+	if (!mappedFile.IsOpen())
+	{
+		return 0;
+	}
+
+	uint32_t chunkObjects = static_cast<uint32_t>(std::min<uint64_t>(maxObjects, objectCount - objectsRead));
+	uint32_t firstObject = gameObjectBounds.Size();
+	gameObjectBounds.Resize(firstObject + chunkObjects);
+
+	const float* records = reinterpret_cast<const float*>(mappedFile.Data() + sizeof(SceneFileHeader)) + objectsRead * 4;
+	float* minX = gameObjectBounds.minX.data() + firstObject;
+	float* minY = gameObjectBounds.minY.data() + firstObject;
+	float* maxX = gameObjectBounds.maxX.data() + firstObject;
+	float* maxY = gameObjectBounds.maxY.data() + firstObject;
+	for (uint32_t i = 0; i < chunkObjects; i++)
+	{
+		minX[i] = records[i * 4 + 0];
+		minY[i] = records[i * 4 + 1];
+		maxX[i] = records[i * 4 + 2];
+		maxY[i] = records[i * 4 + 3];
+	}
+
+	objectsRead += chunkObjects;
+	return chunkObjects;
+}
+
+void SceneReader::RefillCSVBuffer()
+{
+	std::memmove(buffer.data(), buffer.data() + bufferStart, bufferEnd - bufferStart);
+	bufferEnd -= bufferStart;
+	bufferStart = 0;
+
+	size_t bytesRead = std::fread(buffer.data() + bufferEnd, 1, buffer.size() - bufferEnd, file);
+	bufferEnd += bytesRead;
+	if (bytesRead == 0)
+	{
+		endOfFile = true;
+		if (std::ferror(file))
+		{
+			Fail(line + 1);
+		}
+	}
+}
+
+/* Plain decimals like 120.5 are read directly, falling back to from_chars for exponents, inf, nan and long numbers.
+ * With at most 2^24 as the digits and 10^10 as the divisor both are exact floats, so the one division rounds the same as from_chars.
+ */
+const char* ParseCSVNumber(const char* begin, const char* end, float& value)
+{
+	while (begin < end && (*begin == ' ' || *begin == '\t'))
+	{
+		begin++;
+	}
+	if (begin < end && *begin == '+')
+	{
+		begin++;
+	}
+
+	const char* position = begin;
+	bool negative = position < end && *position == '-';
+	if (negative)
+	{
+		position++;
+	}
+
+	uint32_t digits = 0;
+	uint32_t digitCount = 0;
+	uint32_t fractionDigits = 0;
+	bool seenPoint = false;
+	for (; position < end; position++)
+	{
+		if (*position >= '0' && *position <= '9')
+		{
+			digits = digits * 10 + (*position - '0');
+			digitCount++;
+			fractionDigits += seenPoint;
+			// Past 9 digits the value may have overflowed, and is too long for the fast path anyway
+			if (digitCount > 9)
+			{
+				break;
+			}
+		}
+		else if (*position == '.' && !seenPoint)
+		{
+			seenPoint = true;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	bool endsNumber = position == end || (*position != 'e' && *position != 'E' && (*position < '0' || *position > '9'));
+	if (digitCount > 0 && endsNumber && digits <= (1u << 24) && fractionDigits <= 10)
+	{
+		constexpr float POWERS_OF_TEN[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+		value = static_cast<float>(digits) / POWERS_OF_TEN[fractionDigits];
+		value = negative ? -value : value;
+		return position;
+	}
+
+	std::from_chars_result result = std::from_chars(begin, end, value);
+	return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+enum class CSVLine {
+	Object,
+	Skipped,
+	Invalid
+};
+
+// Parses one line without its newline
+CSVLine ParseCSVLine(const char* begin, const char* end, FloatRect& boundingBox)
+{
+	if (end > begin && end[-1] == '\r')
+	{
+		end--;
+	}
+
+	const char* first = begin;
+	while (first < end && (*first == ' ' || *first == '\t'))
+	{
+		first++;
+	}
+	if (first == end || *first == '#')
+	{
+		return CSVLine::Skipped;
+	}
+
+	float values[4];
+	const char* position = begin;
+	for (int i = 0; i < 4; i++)
+	{
+		position = ParseCSVNumber(position, end, values[i]);
+		if (position == nullptr)
+		{
+			return CSVLine::Invalid;
+		}
+		while (position < end && (*position == ' ' || *position == '\t'))
+		{
+			position++;
+		}
+		// Any columns after the fourth are ignored
+		if (i < 3)
+		{
+			if (position == end || *position != ',')
+			{
+				return CSVLine::Invalid;
+			}
+			position++;
+		}
+		else if (position != end && *position != ',')
+		{
+			return CSVLine::Invalid;
+		}
+	}
+
+	boundingBox = FloatRect(values[0], values[1], values[2], values[3]);
+	return CSVLine::Object;
+}
+
+uint32_t SceneReader::ReadCSVChunk(uint32_t maxObjects)
+{
+	if (file == nullptr)
+	{
+		return 0;
+	}
+
+	uint32_t chunkObjects = 0;
+	while (chunkObjects < maxObjects)
+	{
+		const char* lineStart = buffer.data() + bufferStart;
+		const char* bufferLimit = buffer.data() + bufferEnd;
+		const char* lineEnd = static_cast<const char*>(std::memchr(lineStart, '\n', bufferLimit - lineStart));
+		if (lineEnd == nullptr)
+		{
+			// The last line of the file may not end with a newline
+			if (endOfFile)
+			{
+				if (lineStart == bufferLimit)
+				{
+					break;
+				}
+				lineEnd = bufferLimit;
+			}
+			else
+			{
+				if (bufferStart == 0 && bufferEnd == buffer.size())
+				{
+					Fail(line + 1);
+					return 0;
+				}
+				RefillCSVBuffer();
+				if (failed)
+				{
+					return 0;
+				}
+				continue;
+			}
+		}
+
+		line++;
+		bufferStart = std::min<size_t>(lineEnd - buffer.data() + 1, bufferEnd);
+
+		FloatRect boundingBox;
+		CSVLine parsed = ParseCSVLine(lineStart, lineEnd, boundingBox);
+		if (parsed == CSVLine::Object)
+		{
+			gameObjectBounds.Add(boundingBox);
+			chunkObjects++;
+		}
+		// A first line that is not a number is taken as the column names
+		else if (parsed == CSVLine::Invalid && line > 1)
+		{
+			Fail(line);
+			return 0;
+		}
+	}
+	return chunkObjects;
+}
+
+bool LoadScene(const char* path)
+{
+	uint32_t firstObject = gameObjectBounds.Size();
+	SceneReader reader;
+	if (!reader.Open(path))
+	{
+		return false;
+	}
+
+	while (reader.ReadChunk() > 0)
+	{
+	}
+
+	if (reader.Failed())
+	{
+		gameObjectBounds.Resize(firstObject);
+		return false;
+	}
+	return true;
+}
+
+// Writing --------------------------------------------------------------------------------------------------------------------------
+
+bool SaveScene(const char* path, SceneFormat format)
+{
+	std::FILE* file = std::fopen(path, "wb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	bool succeeded = true;
+	if (format == SceneFormat::Binary)
+	{
+		SceneFileHeader header;
+		std::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+		header.version = SCENE_FILE_VERSION;
+		header.byteOrder = SCENE_FILE_BYTE_ORDER;
+		header.objectCount = gameObjectBounds.Size();
+		succeeded = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+		// Interleaved a chunk at a time, so the whole scene is never copied at once
+		std::vector<float> records;
+		records.reserve(SCENE_CHUNK_OBJECTS * 4);
+		for (uint32_t firstObject = 0; succeeded && firstObject < gameObjectBounds.Size(); firstObject += SCENE_CHUNK_OBJECTS)
+		{
+			uint32_t lastObject = std::min(firstObject + SCENE_CHUNK_OBJECTS, gameObjectBounds.Size());
+			records.clear();
+			for (uint32_t object = firstObject; object < lastObject; object++)
+			{
+				records.push_back(gameObjectBounds.minX[object]);
+				records.push_back(gameObjectBounds.minY[object]);
+				records.push_back(gameObjectBounds.maxX[object]);
+				records.push_back(gameObjectBounds.maxY[object]);
+			}
+			succeeded = std::fwrite(records.data(), sizeof(float), records.size(), file) == records.size();
+		}
+	}
+	else
+	{
+		// to_chars writes the shortest text that reads back to the same float, with no locale or allocation
+		succeeded = std::fputs("left,top,width,height\n", file) >= 0;
+		char text[128];
+		for (uint32_t object = 0; succeeded && object < gameObjectBounds.Size(); object++)
+		{
+			FloatRect boundingBox = gameObjectBounds.Get(object);
+			char* position = text;
+			float values[4] = { boundingBox.left, boundingBox.top, boundingBox.width, boundingBox.height };
+			for (int i = 0; i < 4; i++)
+			{
+				position = std::to_chars(position, text + sizeof(text), values[i]).ptr;
+				*position++ = i < 3 ? ',' : '\n';
+			}
+			succeeded = std::fwrite(text, 1, position - text, file) == static_cast<size_t>(position - text);
+		}
+	}
+
+	if (std::fclose(file) != 0)
+	{
+		succeeded = false;
+	}
+	if (!succeeded)
+	{
+		std::remove(path);
+	}
+	return succeeded;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "BVH.h"
+#include "MappedFile.h"
+
+/* Scene files ----------------------------------------------------------------------------------------------------------------------
+ * Streams object bounds from a file straight into gameObjectBounds, a chunk at a time.
+ * Nothing is allocated per object, so level exports of millions of objects load at the speed of the disk.
+ *
+ * Binary scenes are a SceneFileHeader followed by objectCount records of minX, minY, maxX and maxY as 32 bit floats.
+ * They are read from a memory mapping, and the object count in the header lets the bounds arrays be sized once up front.
+ * CSV scenes hold one object per line as left,top,width,height, the same as FloatRect. Blank lines, lines starting with #
+ * and a header line at the top are skipped, and any columns after the fourth are ignored.
+ */
+
+constexpr uint32_t SCENE_FILE_VERSION = 1;
+
+// Binary scene files start with this, any other file is read as CSV
+constexpr char SCENE_FILE_MAGIC[8] = { 'B', 'V', 'H', 'S', 'C', 'E', 'N', 'E' };
+constexpr uint32_t SCENE_FILE_BYTE_ORDER = 0x01020304;
+
+// Objects appended by each ReadChunk unless told otherwise
+constexpr uint32_t SCENE_CHUNK_OBJECTS = 65536;
+
+// Lines of a CSV scene are read through a buffer of this size, no line may be longer
+constexpr size_t SCENE_CSV_BUFFER_SIZE = 1 << 20;
+
+struct SceneFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t objectCount;
+};
+
+enum class SceneFormat {
+	Binary,
+	CSV
+};
+
+/* Reads a scene file a chunk at a time, so the caller can get on with each chunk while the rest is still on disk.
+ *
+ * SceneReader reader;
+ * if (reader.Open(path))
+ * {
+ *     while (uint32_t objectCount = reader.ReadChunk()) { ... the last objectCount objects of gameObjectBounds are new ... }
+ * }
+ * if (reader.Failed()) { ... }
+ */
+struct SceneReader {
+	~SceneReader()
+	{
+		Close();
+	}
+
+	// Closes any file already open. Returns false if the file is missing, or is a binary scene with a bad header
+	bool Open(const char* path);
+	void Close();
+
+	// Appends up to maxObjects objects to gameObjectBounds and returns how many, 0 once the file has been read or has failed
+	uint32_t ReadChunk(uint32_t maxObjects = SCENE_CHUNK_OBJECTS);
+
+	bool Failed() const
+	{
+		return failed;
+	}
+
+	// Line of a CSV scene that could not be read, 0 if there was none
+	uint32_t ErrorLine() const
+	{
+		return errorLine;
+	}
+
+	SceneFormat Format() const
+	{
+		return format;
+	}
+
+private:
+	uint32_t ReadBinaryChunk(uint32_t maxObjects);
+	uint32_t ReadCSVChunk(uint32_t maxObjects);
+	// Moves what is left of the buffer to its front and reads more after it
+	void RefillCSVBuffer();
+	void Fail(uint32_t line);
+
+	SceneFormat format = SceneFormat::Binary;
+	bool failed = false;
+	uint32_t errorLine = 0;
+
+	// Binary scenes
+	MappedFile mappedFile;
+	uint64_t objectCount = 0;
+	uint64_t objectsRead = 0;
+
+	// CSV scenes
+	std::FILE* file = nullptr;
+	std::vector<char> buffer;
+	size_t bufferStart = 0;
+	size_t bufferEnd = 0;
+	bool endOfFile = false;
+	uint32_t line = 0;
+};
+
+/* Appends every object of a scene file to gameObjectBounds, returns false if it could not be read.
+ * Objects appended before a failure are removed again, so gameObjectBounds is left as it was.
+ */
+bool LoadScene(const char* path);
+
+// Writes every object of gameObjectBounds as a binary or CSV scene
+bool SaveScene(const char* path, SceneFormat format = SceneFormat::Binary);
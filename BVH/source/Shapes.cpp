@@ -0,0 +1,486 @@
+#include "Shapes.h"
+
+#include <cmath>
+
+GameObjectShapes gameObjectShapes;
+
+// Exact tests ----------------------------------------------------------------------------------------------------------------------
+// Every test is branch free, so the batched loops below can run them several candidates at a time
+
+inline float Clamp(float value, float smallest, float largest)
+{
+	value = value < smallest ? smallest : value;
+	return value > largest ? largest : value;
+}
+
+inline float Min(float a, float b)
+{
+	return a < b ? a : b;
+}
+
+inline float Max(float a, float b)
+{
+	return a > b ? a : b;
+}
+
+/* Adds up the distance outside each side rather than clamping the point to the box, as GCC turns a chain of two ternaries
+ * on the same value back into branches and then cannot vectorize the loop. Only one side of each axis can be positive.
+ */
+inline float PointBoxDistanceSquared(float x, float y, float minX, float minY, float maxX, float maxY)
+{
+	float dx = Max(minX - x, 0.0f) + Max(x - maxX, 0.0f);
+	float dy = Max(minY - y, 0.0f) + Max(y - maxY, 0.0f);
+	return dx * dx + dy * dy;
+}
+
+inline float PointSegmentDistanceSquared(float x, float y, float startX, float startY, float endX, float endY)
+{
+	float segmentX = endX - startX;
+	float segmentY = endY - startY;
+	float lengthSquared = segmentX * segmentX + segmentY * segmentY;
+	float projected = (x - startX) * segmentX + (y - startY) * segmentY;
+	/* Clamping the quotient to 0 and 1 has the same problem as clamping to a box, clamping before dividing does not.
+	 * A segment of zero length is a point, with projected = 0 and so t = 0.
+	 */
+	float t = Clamp(projected, 0.0f, lengthSquared) / Max(lengthSquared, FLT_MIN);
+	float dx = startX + segmentX * t - x;
+	float dy = startY + segmentY * t - y;
+	return dx * dx + dy * dy;
+}
+
+inline bool CircleBoxCollision(const CircleShape& circle, float minX, float minY, float maxX, float maxY)
+{
+	return PointBoxDistanceSquared(circle.centreX, circle.centreY, minX, minY, maxX, maxY) < circle.radius * circle.radius;
+}
+
+inline bool CircleCircleCollision(const CircleShape& circle, float centreX, float centreY, float radius)
+{
+	float dx = centreX - circle.centreX;
+	float dy = centreY - circle.centreY;
+	float radii = circle.radius + radius;
+	return dx * dx + dy * dy < radii * radii;
+}
+
+inline bool CircleCapsuleCollision(const CircleShape& circle, float startX, float startY, float endX, float endY, float radius)
+{
+	float radii = circle.radius + radius;
+	return PointSegmentDistanceSquared(circle.centreX, circle.centreY, startX, startY, endX, endY) < radii * radii;
+}
+
+/* In 2D, the closest points of a segment and a box that do not cross are a corner or end point of one and an edge of the other.
+ * The segment crosses the box when their boxes overlap and the box's corners are not all on one side of the segment's line.
+ * Both are tested strictly, so a capsule of radius 0 collides where its segment crosses the box but not where it only touches.
+ */
+inline bool BoxCapsuleCollision(FloatRect box, float startX, float startY, float endX, float endY, float radius)
+{
+	float minX = box.left;
+	float minY = box.top;
+	float maxX = box.left + box.width;
+	float maxY = box.top + box.height;
+
+	float normalX = startY - endY;
+	float normalY = endX - startX;
+	float side0 = normalX * (minX - startX) + normalY * (minY - startY);
+	float side1 = normalX * (maxX - startX) + normalY * (minY - startY);
+	float side2 = normalX * (minX - startX) + normalY * (maxY - startY);
+	float side3 = normalX * (maxX - startX) + normalY * (maxY - startY);
+	bool straddles = (Min(Min(side0, side1), Min(side2, side3)) < 0.0f) & (Max(Max(side0, side1), Max(side2, side3)) > 0.0f);
+	bool boxesOverlap = (Min(startX, endX) < maxX) & (Max(startX, endX) > minX) & (Min(startY, endY) < maxY) & (Max(startY, endY) > minY);
+
+	float distanceSquared = Min(
+		Min(PointBoxDistanceSquared(startX, startY, minX, minY, maxX, maxY), PointBoxDistanceSquared(endX, endY, minX, minY, maxX, maxY)),
+		Min(Min(PointSegmentDistanceSquared(minX, minY, startX, startY, endX, endY), PointSegmentDistanceSquared(maxX, minY, startX, startY, endX, endY)),
+			Min(PointSegmentDistanceSquared(minX, maxY, startX, startY, endX, endY), PointSegmentDistanceSquared(maxX, maxY, startX, startY, endX, endY))));
+	return (straddles & boxesOverlap) | (distanceSquared < radius * radius);
+}
+
+// Separating axes are the two box axes and the outward normal of every polygon edge
+bool BoxPolygonCollision(FloatRect box, const ConvexPolygonShape& polygon)
+{
+	float polygonMinX = FLT_MAX, polygonMinY = FLT_MAX, polygonMaxX = -FLT_MAX, polygonMaxY = -FLT_MAX;
+	for (uint32_t i = 0; i < polygon.vertexCount; i++)
+	{
+		polygonMinX = Min(polygon.x[i], polygonMinX);
+		polygonMinY = Min(polygon.y[i], polygonMinY);
+		polygonMaxX = Max(polygon.x[i], polygonMaxX);
+		polygonMaxY = Max(polygon.y[i], polygonMaxY);
+	}
+	if (!BoxBoxCollision(box, FloatRect(polygonMinX, polygonMinY, polygonMaxX - polygonMinX, polygonMaxY - polygonMinY)))
+	{
+		return false;
+	}
+
+	float halfWidth = box.width * 0.5f;
+	float halfHeight = box.height * 0.5f;
+	float centreX = box.left + halfWidth;
+	float centreY = box.top + halfHeight;
+	for (uint32_t i = 0; i < polygon.vertexCount; i++)
+	{
+		uint32_t next = i + 1 < polygon.vertexCount ? i + 1 : 0;
+		float normalX = polygon.y[next] - polygon.y[i];
+		float normalY = polygon.x[i] - polygon.x[next];
+		float boxNearest = normalX * centreX + normalY * centreY - (halfWidth * std::abs(normalX) + halfHeight * std::abs(normalY));
+		if (boxNearest >= normalX * polygon.x[i] + normalY * polygon.y[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CirclePolygonCollision(const CircleShape& circle, const ConvexPolygonShape& polygon)
+{
+	bool inside = polygon.vertexCount > 0;
+	float distanceSquared = FLT_MAX;
+	for (uint32_t i = 0; i < polygon.vertexCount; i++)
+	{
+		uint32_t next = i + 1 < polygon.vertexCount ? i + 1 : 0;
+		float normalX = polygon.y[next] - polygon.y[i];
+		float normalY = polygon.x[i] - polygon.x[next];
+		inside &= normalX * (circle.centreX - polygon.x[i]) + normalY * (circle.centreY - polygon.y[i]) < 0.0f;
+		distanceSquared = Min(PointSegmentDistanceSquared(circle.centreX, circle.centreY, polygon.x[i], polygon.y[i], polygon.x[next], polygon.y[next]), distanceSquared);
+	}
+	return inside || distanceSquared < circle.radius * circle.radius;
+}
+
+bool ShapeCollision(FloatRect searchBox, uint32_t object)
+{
+	if (!BoxObjectCollision(searchBox, object))
+	{
+		return false;
+	}
+
+	uint32_t shape = object < gameObjectShapes.shapeIndices.size() ? gameObjectShapes.shapeIndices[object] : 0;
+	switch (GetShapeType(object))
+	{
+	case ShapeType::Circle:
+	{
+		CircleShape circle = { gameObjectShapes.circles.centreX[shape], gameObjectShapes.circles.centreY[shape], gameObjectShapes.circles.radius[shape] };
+		return CircleBoxCollision(circle, searchBox.left, searchBox.top, searchBox.left + searchBox.width, searchBox.top + searchBox.height);
+	}
+	case ShapeType::Capsule:
+		return BoxCapsuleCollision(searchBox, gameObjectShapes.capsules.startX[shape], gameObjectShapes.capsules.startY[shape],
+			gameObjectShapes.capsules.endX[shape], gameObjectShapes.capsules.endY[shape], gameObjectShapes.capsules.radius[shape]);
+	case ShapeType::ConvexPolygon:
+		return BoxPolygonCollision(searchBox, gameObjectShapes.polygons[shape]);
+	default:
+		return true;
+	}
+}
+
+bool ShapeCollision(const CircleShape& searchCircle, uint32_t object)
+{
+	uint32_t shape = object < gameObjectShapes.shapeIndices.size() ? gameObjectShapes.shapeIndices[object] : 0;
+	switch (GetShapeType(object))
+	{
+	case ShapeType::Circle:
+		return CircleCircleCollision(searchCircle, gameObjectShapes.circles.centreX[shape], gameObjectShapes.circles.centreY[shape],
+			gameObjectShapes.circles.radius[shape]);
+	case ShapeType::Capsule:
+		return CircleCapsuleCollision(searchCircle, gameObjectShapes.capsules.startX[shape], gameObjectShapes.capsules.startY[shape],
+			gameObjectShapes.capsules.endX[shape], gameObjectShapes.capsules.endY[shape], gameObjectShapes.capsules.radius[shape]);
+	case ShapeType::ConvexPolygon:
+		return CirclePolygonCollision(searchCircle, gameObjectShapes.polygons[shape]);
+	default:
+		return CircleBoxCollision(searchCircle, gameObjectBounds.minX[object], gameObjectBounds.minY[object],
+			gameObjectBounds.maxX[object], gameObjectBounds.maxY[object]);
+	}
+}
+
+// Setting shapes -------------------------------------------------------------------------------------------------------------------
+
+// Objects added since the last shape was set are boxes
+void GrowShapeTable(uint32_t object)
+{
+	if (object >= gameObjectShapes.types.size())
+	{
+		gameObjectShapes.types.resize(object + 1, ShapeType::Box);
+		gameObjectShapes.shapeIndices.resize(object + 1, 0);
+	}
+}
+
+ShapeType GetShapeType(uint32_t object)
+{
+	return object < gameObjectShapes.types.size() ? gameObjectShapes.types[object] : ShapeType::Box;
+}
+
+// Returns the index within the packed array of the type to write the object's shape to, reusing the old one if the type is the same
+uint32_t ShapeIndexFor(uint32_t object, ShapeType type, size_t packedCount)
+{
+	GrowShapeTable(object);
+	if (gameObjectShapes.types[object] != type)
+	{
+		gameObjectShapes.types[object] = type;
+		gameObjectShapes.shapeIndices[object] = static_cast<uint32_t>(packedCount);
+	}
+	return gameObjectShapes.shapeIndices[object];
+}
+
+template <typename T>
+void SetPacked(std::vector<T>& packed, uint32_t index, T value)
+{
+	if (index == packed.size())
+	{
+		packed.push_back(value);
+	}
+	else
+	{
+		packed[index] = value;
+	}
+}
+
+void SetBoxShape(uint32_t object)
+{
+	if (object < gameObjectShapes.types.size())
+	{
+		gameObjectShapes.types[object] = ShapeType::Box;
+	}
+}
+
+void SetCircleShape(uint32_t object, const CircleShape& circle)
+{
+	auto& circles = gameObjectShapes.circles;
+	uint32_t shape = ShapeIndexFor(object, ShapeType::Circle, circles.radius.size());
+	SetPacked(circles.centreX, shape, circle.centreX);
+	SetPacked(circles.centreY, shape, circle.centreY);
+	SetPacked(circles.radius, shape, circle.radius);
+	gameObjectBounds.Set(object, FloatRect(circle.centreX - circle.radius, circle.centreY - circle.radius, circle.radius * 2, circle.radius * 2));
+}
+
+void SetCapsuleShape(uint32_t object, const CapsuleShape& capsule)
+{
+	auto& capsules = gameObjectShapes.capsules;
+	uint32_t shape = ShapeIndexFor(object, ShapeType::Capsule, capsules.radius.size());
+	SetPacked(capsules.startX, shape, capsule.startX);
+	SetPacked(capsules.startY, shape, capsule.startY);
+	SetPacked(capsules.endX, shape, capsule.endX);
+	SetPacked(capsules.endY, shape, capsule.endY);
+	SetPacked(capsules.radius, shape, capsule.radius);
+	float minX = std::min(capsule.startX, capsule.endX) - capsule.radius;
+	float minY = std::min(capsule.startY, capsule.endY) - capsule.radius;
+	float maxX = std::max(capsule.startX, capsule.endX) + capsule.radius;
+	float maxY = std::max(capsule.startY, capsule.endY) + capsule.radius;
+	gameObjectBounds.Set(object, FloatRect(minX, minY, maxX - minX, maxY - minY));
+}
+
+void SetPolygonShape(uint32_t object, const float* x, const float* y, uint32_t vertexCount)
+{
+	ConvexPolygonShape polygon;
+	polygon.vertexCount = std::min(vertexCount, MAX_POLYGON_VERTICES);
+
+	// A negative signed area means the vertices go the other way round, so they are copied in reverse
+	float signedArea = 0.0f;
+	for (uint32_t i = 0; i < polygon.vertexCount; i++)
+	{
+		uint32_t next = i + 1 < polygon.vertexCount ? i + 1 : 0;
+		signedArea += x[i] * y[next] - x[next] * y[i];
+	}
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (uint32_t i = 0; i < polygon.vertexCount; i++)
+	{
+		uint32_t source = signedArea < 0.0f ? polygon.vertexCount - 1 - i : i;
+		polygon.x[i] = x[source];
+		polygon.y[i] = y[source];
+		minX = std::min(x[source], minX);
+		minY = std::min(y[source], minY);
+		maxX = std::max(x[source], maxX);
+		maxY = std::max(y[source], maxY);
+	}
+
+	uint32_t shape = ShapeIndexFor(object, ShapeType::ConvexPolygon, gameObjectShapes.polygons.size());
+	SetPacked(gameObjectShapes.polygons, shape, polygon);
+	gameObjectBounds.Set(object, FloatRect(minX, minY, maxX - minX, maxY - minY));
+}
+
+void ClearShapes()
+{
+	gameObjectShapes.types.clear();
+	gameObjectShapes.shapeIndices.clear();
+	gameObjectShapes.circles.centreX.clear();
+	gameObjectShapes.circles.centreY.clear();
+	gameObjectShapes.circles.radius.clear();
+	gameObjectShapes.capsules.startX.clear();
+	gameObjectShapes.capsules.startY.clear();
+	gameObjectShapes.capsules.endX.clear();
+	gameObjectShapes.capsules.endY.clear();
+	gameObjectShapes.capsules.radius.clear();
+	gameObjectShapes.polygons.clear();
+}
+
+// Batched queries ------------------------------------------------------------------------------------------------------------------
+
+void GatherCandidates(ShapeQueryScratch& scratch, FloatRect searchBox)
+{
+	for (std::vector<uint32_t>& candidates : scratch.candidates)
+	{
+		candidates.clear();
+	}
+	QueryBVH(searchBox, [&scratch](uint32_t object) { scratch.candidates[static_cast<int>(GetShapeType(object))].push_back(object); });
+}
+
+// Copies one packed shape array into batch slot for every candidate, so the test loop reads memory in order
+void GatherBatch(ShapeQueryScratch& scratch, int slot, const std::vector<uint32_t>& candidates, const std::vector<float>& packed, bool byObject = false)
+{
+	std::vector<float>& batch = scratch.batch[slot];
+	batch.resize(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		uint32_t object = candidates[i];
+		batch[i] = packed[byObject ? object : gameObjectShapes.shapeIndices[object]];
+	}
+}
+
+// Runs collided(i) over the whole batch in one loop with no branches, then appends the candidates that collided
+template <typename Test>
+void RunBatch(ShapeQueryScratch& scratch, const std::vector<uint32_t>& candidates, std::vector<uint32_t>& hits, Test&& collided)
+{
+	uint32_t count = static_cast<uint32_t>(candidates.size());
+	scratch.collided.resize(count);
+	uint32_t* results = scratch.collided.data();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		results[i] = collided(i);
+	}
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (results[i])
+		{
+			hits.push_back(candidates[i]);
+		}
+	}
+}
+
+uint32_t CandidateCount(const ShapeQueryScratch& scratch)
+{
+	uint32_t count = 0;
+	for (const std::vector<uint32_t>& candidates : scratch.candidates)
+	{
+		count += static_cast<uint32_t>(candidates.size());
+	}
+	return count;
+}
+
+void QueryShapes(ShapeQueryScratch& scratch, FloatRect searchBox, std::vector<uint32_t>& hits, uint32_t* candidateCount)
+{
+	GatherCandidates(scratch, searchBox);
+	if (candidateCount != nullptr)
+	{
+		*candidateCount = CandidateCount(scratch);
+	}
+
+	// The traversal already made the exact test for boxes
+	const std::vector<uint32_t>& boxes = scratch.candidates[static_cast<int>(ShapeType::Box)];
+	hits.insert(hits.end(), boxes.begin(), boxes.end());
+
+	const float minX = searchBox.left;
+	const float minY = searchBox.top;
+	const float maxX = searchBox.left + searchBox.width;
+	const float maxY = searchBox.top + searchBox.height;
+
+	const std::vector<uint32_t>& circles = scratch.candidates[static_cast<int>(ShapeType::Circle)];
+	GatherBatch(scratch, 0, circles, gameObjectShapes.circles.centreX);
+	GatherBatch(scratch, 1, circles, gameObjectShapes.circles.centreY);
+	GatherBatch(scratch, 2, circles, gameObjectShapes.circles.radius);
+	{
+		const float* centreX = scratch.batch[0].data();
+		const float* centreY = scratch.batch[1].data();
+		const float* radius = scratch.batch[2].data();
+		RunBatch(scratch, circles, hits, [=](uint32_t i)
+		{
+			return CircleBoxCollision({ centreX[i], centreY[i], radius[i] }, minX, minY, maxX, maxY);
+		});
+	}
+
+	const std::vector<uint32_t>& capsules = scratch.candidates[static_cast<int>(ShapeType::Capsule)];
+	GatherBatch(scratch, 0, capsules, gameObjectShapes.capsules.startX);
+	GatherBatch(scratch, 1, capsules, gameObjectShapes.capsules.startY);
+	GatherBatch(scratch, 2, capsules, gameObjectShapes.capsules.endX);
+	GatherBatch(scratch, 3, capsules, gameObjectShapes.capsules.endY);
+	GatherBatch(scratch, 4, capsules, gameObjectShapes.capsules.radius);
+	{
+		const float* startX = scratch.batch[0].data();
+		const float* startY = scratch.batch[1].data();
+		const float* endX = scratch.batch[2].data();
+		const float* endY = scratch.batch[3].data();
+		const float* radius = scratch.batch[4].data();
+		RunBatch(scratch, capsules, hits, [=](uint32_t i)
+		{
+			return BoxCapsuleCollision(searchBox, startX[i], startY[i], endX[i], endY[i], radius[i]);
+		});
+	}
+
+	// Polygons differ in their number of edges, so they are tested one at a time
+	for (uint32_t object : scratch.candidates[static_cast<int>(ShapeType::ConvexPolygon)])
+	{
+		if (BoxPolygonCollision(searchBox, gameObjectShapes.polygons[gameObjectShapes.shapeIndices[object]]))
+		{
+			hits.push_back(object);
+		}
+	}
+}
+
+void QueryShapes(ShapeQueryScratch& scratch, const CircleShape& searchCircle, std::vector<uint32_t>& hits, uint32_t* candidateCount)
+{
+	float radius = searchCircle.radius;
+	GatherCandidates(scratch, FloatRect(searchCircle.centreX - radius, searchCircle.centreY - radius, radius * 2, radius * 2));
+	if (candidateCount != nullptr)
+	{
+		*candidateCount = CandidateCount(scratch);
+	}
+
+	const std::vector<uint32_t>& boxes = scratch.candidates[static_cast<int>(ShapeType::Box)];
+	GatherBatch(scratch, 0, boxes, gameObjectBounds.minX, true);
+	GatherBatch(scratch, 1, boxes, gameObjectBounds.minY, true);
+	GatherBatch(scratch, 2, boxes, gameObjectBounds.maxX, true);
+	GatherBatch(scratch, 3, boxes, gameObjectBounds.maxY, true);
+	{
+		const float* minX = scratch.batch[0].data();
+		const float* minY = scratch.batch[1].data();
+		const float* maxX = scratch.batch[2].data();
+		const float* maxY = scratch.batch[3].data();
+		RunBatch(scratch, boxes, hits, [=](uint32_t i)
+		{
+			return CircleBoxCollision(searchCircle, minX[i], minY[i], maxX[i], maxY[i]);
+		});
+	}
+
+	const std::vector<uint32_t>& circles = scratch.candidates[static_cast<int>(ShapeType::Circle)];
+	GatherBatch(scratch, 0, circles, gameObjectShapes.circles.centreX);
+	GatherBatch(scratch, 1, circles, gameObjectShapes.circles.centreY);
+	GatherBatch(scratch, 2, circles, gameObjectShapes.circles.radius);
+	{
+		const float* centreX = scratch.batch[0].data();
+		const float* centreY = scratch.batch[1].data();
+		const float* circleRadius = scratch.batch[2].data();
+		RunBatch(scratch, circles, hits, [=](uint32_t i)
+		{
+			return CircleCircleCollision(searchCircle, centreX[i], centreY[i], circleRadius[i]);
+		});
+	}
+
+	const std::vector<uint32_t>& capsules = scratch.candidates[static_cast<int>(ShapeType::Capsule)];
+	GatherBatch(scratch, 0, capsules, gameObjectShapes.capsules.startX);
+	GatherBatch(scratch, 1, capsules, gameObjectShapes.capsules.startY);
+	GatherBatch(scratch, 2, capsules, gameObjectShapes.capsules.endX);
+	GatherBatch(scratch, 3, capsules, gameObjectShapes.capsules.endY);
+	GatherBatch(scratch, 4, capsules, gameObjectShapes.capsules.radius);
+	{
+		const float* startX = scratch.batch[0].data();
+		const float* startY = scratch.batch[1].data();
+		const float* endX = scratch.batch[2].data();
+		const float* endY = scratch.batch[3].data();
+		const float* capsuleRadius = scratch.batch[4].data();
+		RunBatch(scratch, capsules, hits, [=](uint32_t i)
+		{
+			return CircleCapsuleCollision(searchCircle, startX[i], startY[i], endX[i], endY[i], capsuleRadius[i]);
+		});
+	}
+
+	for (uint32_t object : scratch.candidates[static_cast<int>(ShapeType::ConvexPolygon)])
+	{
+		if (CirclePolygonCollision(searchCircle, gameObjectShapes.polygons[gameObjectShapes.shapeIndices[object]]))
+		{
+			hits.push_back(object);
+		}
+	}
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+
+/* Shapes ---------------------------------------------------------------------------------------------------------------------------
+ * Exact shapes for objects that are not boxes, kept in a side table indexed by object like gameObjectBounds.
+ * Setting a shape also sets the object's bounds to the shape's box, so building and traversing the bvh are unchanged.
+ * QueryShapes traverses with the search shape's box, sorts the hits into one bucket per shape type, then runs each bucket
+ * through that type's exact test in one batch over packed arrays, which the compiler turns into SIMD loops.
+ *
+ * Like BoxBoxCollision, shapes that only touch do not collide.
+ */
+
+enum class ShapeType : uint8_t {
+	// The object's bounds are its exact shape
+	Box,
+	Circle,
+	Capsule,
+	ConvexPolygon,
+	Count
+};
+
+constexpr uint32_t MAX_POLYGON_VERTICES = 8;
+
+struct CircleShape {
+	float centreX;
+	float centreY;
+	float radius;
+};
+
+// Every point within radius of the segment from start to end
+struct CapsuleShape {
+	float startX;
+	float startY;
+	float endX;
+	float endY;
+	float radius;
+};
+
+struct ConvexPolygonShape {
+	uint32_t vertexCount = 0;
+	// Wound so that (edgeY, -edgeX) points outwards, SetPolygonShape fixes the winding of whatever it is given
+	float x[MAX_POLYGON_VERTICES];
+	float y[MAX_POLYGON_VERTICES];
+};
+
+/* Each object has a type and an index into the packed array of that type, objects never given a shape are boxes.
+ * Giving an object a shape of another type leaves its old shape unused until ClearShapes.
+ */
+struct GameObjectShapes {
+	std::vector<ShapeType> types;
+	std::vector<uint32_t> shapeIndices;
+
+	struct {
+		std::vector<float> centreX;
+		std::vector<float> centreY;
+		std::vector<float> radius;
+	} circles;
+
+	struct {
+		std::vector<float> startX;
+		std::vector<float> startY;
+		std::vector<float> endX;
+		std::vector<float> endY;
+		std::vector<float> radius;
+	} capsules;
+
+	std::vector<ConvexPolygonShape> polygons;
+};
+
+extern GameObjectShapes gameObjectShapes;
+
+// Each of these sets the object's bounds in gameObjectBounds as well, refit or rebuild the bvh afterwards as with gameObjectBounds.Set
+void SetBoxShape(uint32_t object);
+void SetCircleShape(uint32_t object, const CircleShape& circle);
+void SetCapsuleShape(uint32_t object, const CapsuleShape& capsule);
+// Takes up to MAX_POLYGON_VERTICES vertices of a convex polygon in either winding
+void SetPolygonShape(uint32_t object, const float* x, const float* y, uint32_t vertexCount);
+
+ShapeType GetShapeType(uint32_t object);
+
+// Makes every object a box again, gameObjectBounds keeps the boxes of the old shapes
+void ClearShapes();
+
+/* Scratch space of QueryShapes: the candidates of every type from the traversal, and the packed copies of their shapes
+ * for the batched tests. Owned by the caller like QueryContext, so queries on different threads each use their own.
+ * Kept between queries, so queries stop allocating once they have seen their largest batch.
+ */
+struct ShapeQueryScratch {
+	std::vector<uint32_t> candidates[static_cast<int>(ShapeType::Count)];
+	std::vector<float> batch[5];
+	std::vector<uint32_t> collided;
+};
+
+/* Appends every object whose exact shape collides with the search shape to hits, grouped by shape type.
+ * candidateCount, if given, is set to the number of objects whose bounds alone collided, for measuring how many the exact tests removed.
+ */
+void QueryShapes(ShapeQueryScratch& scratch, FloatRect searchBox, std::vector<uint32_t>& hits, uint32_t* candidateCount = nullptr);
+void QueryShapes(ShapeQueryScratch& scratch, const CircleShape& searchCircle, std::vector<uint32_t>& hits, uint32_t* candidateCount = nullptr);
+
+// Exact test of one object against the search shape, without the bvh
+bool ShapeCollision(FloatRect searchBox, uint32_t object);
+bool ShapeCollision(const CircleShape& searchCircle, uint32_t object);
+
+// Ignores the bvh and checks every object, useful to check if QueryShapes is working correctly
+template <typename SearchShape>
+void BruteForceQueryShapes(const SearchShape& searchShape, std::vector<uint32_t>& hits)
+{
+	for (uint32_t object = 0; object < gameObjectBounds.Size(); object++)
+	{
+		if (ShapeCollision(searchShape, object))
+		{
+			hits.push_back(object);
+		}
+	}
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Counts the tasks spawned into it that have not finished yet, see ThreadPool::Spawn
+struct TaskGroup {
+	std::atomic<uint32_t> pendingTasks{ 0 };
+};
+
+/* Fixed set of worker threads that are kept alive between runs.
+ * Run hands out job indices to the workers and the calling thread, and returns once every job is done.
+ * Only one Run can be in flight at a time, and it must not be called from within a job or a task.
+ *
+ * Spawn and Wait are for recursive work. Every thread pushes its tasks onto the back of its own queue
+ * and takes them from the back again, idle threads steal from the front of the other queues.
+ * Waiting on a group runs other tasks until the group is done, so tasks can spawn and wait on tasks themselves.
+ * Tasks are copied into the queues as they are, so once the queues have grown to fit nothing is allocated per task.
+ */
+struct ThreadPool {
+	explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency())
+	{
+		// The calling thread also works on jobs, so it counts as one of the threads and gets the last queue
+		for (unsigned i = 0; i < std::max(threadCount, 1u); i++)
+		{
+			taskQueues.emplace_back(new TaskQueue());
+		}
+		for (unsigned i = 1; i < threadCount; i++)
+		{
+			workers.emplace_back([this, i]() { WorkerLoop(i - 1); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t ThreadCount() const
+	{
+		return static_cast<uint32_t>(workers.size()) + 1;
+	}
+
+	// Calls job(jobIndex) for every jobIndex in [0, jobCount)
+	template <typename Job>
+	void Run(uint32_t jobCount, Job&& job)
+	{
+		if (workers.empty() || jobCount <= 1)
+		{
+			for (uint32_t i = 0; i < jobCount; i++)
+			{
+				job(i);
+			}
+			return;
+		}
+
+		// The job is called through a plain function pointer so nothing is allocated per run
+		using JobType = std::remove_reference_t<Job>;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobFunction = [](void* context, uint32_t jobIndex) { (*static_cast<JobType*>(context))(jobIndex); };
+			jobContext = const_cast<void*>(static_cast<const void*>(&job));
+			totalJobs = jobCount;
+			nextJob = 0;
+			busyWorkers = static_cast<uint32_t>(workers.size());
+			generation++;
+		}
+		wake.notify_all();
+
+		RunJobs();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this]() { return busyWorkers == 0; });
+	}
+
+	/* Queues task() to run on any thread, group counts it until it has finished.
+	 * The task has to be small and trivially copyable, which any lambda capturing pointers, numbers or references is
+	 */
+	template <typename Task>
+	void Spawn(TaskGroup& group, Task&& task)
+	{
+		using TaskType = std::decay_t<Task>;
+		static_assert(sizeof(TaskType) <= QueuedTask::STORAGE_SIZE && alignof(TaskType) <= alignof(std::max_align_t),
+			"Task captures too much to be queued, capture by reference instead");
+		static_assert(std::is_trivially_copyable<TaskType>::value && std::is_trivially_destructible<TaskType>::value,
+			"Task must be trivially copyable, capture by reference instead");
+
+		group.pendingTasks++;
+		if (workers.empty())
+		{
+			task();
+			group.pendingTasks--;
+			return;
+		}
+
+		QueuedTask queued;
+		new (queued.storage) TaskType(std::forward<Task>(task));
+		queued.run = [](void* storage) { (*static_cast<TaskType*>(storage))(); };
+		queued.group = &group;
+
+		TaskQueue& queue = *taskQueues[CurrentQueue()];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.PushBack(queued);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queuedTasks++;
+		}
+		wake.notify_one();
+	}
+
+	// Runs queued tasks until every task in the group has finished
+	void Wait(TaskGroup& group)
+	{
+		while (group.pendingTasks > 0)
+		{
+			if (!TryRunTask())
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+private:
+	// A copy of the task itself, run through a plain function pointer
+	struct QueuedTask {
+		static constexpr size_t STORAGE_SIZE = 48;
+		alignas(std::max_align_t) unsigned char storage[STORAGE_SIZE];
+		void (*run)(void*) = nullptr;
+		TaskGroup* group = nullptr;
+	};
+
+	// Ring buffer of tasks, doubled in size whenever it fills up and never shrunk
+	struct TaskQueue {
+		std::mutex mutex;
+		std::vector<QueuedTask> tasks;
+		size_t head = 0;
+		size_t count = 0;
+
+		void PushBack(const QueuedTask& task)
+		{
+			if (count == tasks.size())
+			{
+				std::vector<QueuedTask> grown(std::max<size_t>(tasks.size() * 2, 64));
+				for (size_t i = 0; i < count; i++)
+				{
+					grown[i] = tasks[(head + i) % tasks.size()];
+				}
+				tasks.swap(grown);
+				head = 0;
+			}
+			tasks[(head + count) % tasks.size()] = task;
+			count++;
+		}
+
+		QueuedTask PopBack()
+		{
+			count--;
+			return tasks[(head + count) % tasks.size()];
+		}
+
+		QueuedTask PopFront()
+		{
+			QueuedTask task = tasks[head];
+			head = (head + 1) % tasks.size();
+			count--;
+			return task;
+		}
+	};
+
+	// Workers use their own queue, any other thread uses the last one
+	size_t CurrentQueue() const
+	{
+		return workerPool == this ? workerIndex : taskQueues.size() - 1;
+	}
+
+	// Takes the newest task of this thread's queue, or steals the oldest task of another queue
+	bool TryRunTask()
+	{
+		size_t own = CurrentQueue();
+		QueuedTask queued;
+		bool found = false;
+		for (size_t i = 0; i < taskQueues.size() && !found; i++)
+		{
+			TaskQueue& queue = *taskQueues[(own + i) % taskQueues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.count == 0)
+			{
+				continue;
+			}
+			queued = i == 0 ? queue.PopBack() : queue.PopFront();
+			found = true;
+		}
+		if (!found)
+		{
+			return false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queuedTasks--;
+		}
+		queued.run(queued.storage);
+		queued.group->pendingTasks--;
+		return true;
+	}
+
+	void RunJobs()
+	{
+		uint32_t jobIndex;
+		while ((jobIndex = nextJob.fetch_add(1)) < totalJobs)
+		{
+			jobFunction(jobContext, jobIndex);
+		}
+	}
+
+	void WorkerLoop(size_t index)
+	{
+		workerPool = this;
+		workerIndex = index;
+
+		uint64_t seenGeneration = 0;
+		while (true)
+		{
+			if (TryRunTask())
+			{
+				continue;
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&]() { return stopping || generation != seenGeneration || queuedTasks > 0; });
+				if (stopping)
+				{
+					return;
+				}
+				if (generation == seenGeneration)
+				{
+					continue;
+				}
+				seenGeneration = generation;
+			}
+
+			RunJobs();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busyWorkers == 0)
+			{
+				done.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<TaskQueue>> taskQueues;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	void (*jobFunction)(void*, uint32_t) = nullptr;
+	void* jobContext = nullptr;
+	uint32_t totalJobs = 0;
+	std::atomic<uint32_t> nextJob{ 0 };
+	uint32_t busyWorkers = 0;
+	uint64_t generation = 0;
+	uint32_t queuedTasks = 0;
+	bool stopping = false;
+
+	static inline thread_local ThreadPool* workerPool = nullptr;
+	static inline thread_local size_t workerIndex = 0;
+};
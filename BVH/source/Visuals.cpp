@@ -0,0 +1,58 @@
+#include "Visuals.h"
+
+// Depth of every node, kept between calls like the build scratch space
+std::vector<uint32_t> nodeDepths;
+
+// Appends the four corners of a rectangle
+void AddQuad(std::vector<VisualVertex>& vertices, float left, float top, float right, float bottom, VisualColour colour)
+{
+	vertices.push_back({ left, top, colour });
+	vertices.push_back({ right, top, colour });
+	vertices.push_back({ right, bottom, colour });
+	vertices.push_back({ left, bottom, colour });
+}
+
+void BuildObjectVertices(const GameObjectBounds& bounds, const std::vector<VisualColour>& colours, std::vector<VisualVertex>& vertices)
+{
+	vertices.clear();
+	vertices.reserve(bounds.Size() * 4);
+	for (uint32_t object = 0; object < bounds.Size(); object++)
+	{
+		AddQuad(vertices, bounds.minX[object], bounds.minY[object], bounds.maxX[object], bounds.maxY[object], colours[object]);
+	}
+}
+
+uint32_t BuildNodeVertices(const std::vector<Node>& nodes, float outlineThickness, VisualColour colour, std::vector<std::vector<VisualVertex>>& layers)
+{
+	for (std::vector<VisualVertex>& layer : layers)
+	{
+		layer.clear();
+	}
+
+	// Parents always come before their children, so one pass in order finds every depth
+	uint32_t layerCount = 0;
+	nodeDepths.resize(nodes.size());
+	for (uint32_t nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++)
+	{
+		const Node& node = nodes[nodeIndex];
+		uint32_t depth = node.previousNode == NULL_NODE ? 0 : nodeDepths[node.previousNode] + 1;
+		nodeDepths[nodeIndex] = depth;
+		layerCount = std::max(depth + 1, layerCount);
+		if (depth >= layers.size())
+		{
+			layers.resize(depth + 1);
+		}
+
+		// Four bands around the bounds, the top and bottom ones covering the corners
+		float left = node.boundingBox.left;
+		float top = node.boundingBox.top;
+		float right = left + node.boundingBox.width;
+		float bottom = top + node.boundingBox.height;
+		std::vector<VisualVertex>& layer = layers[depth];
+		AddQuad(layer, left - outlineThickness, top - outlineThickness, right + outlineThickness, top, colour);
+		AddQuad(layer, left - outlineThickness, bottom, right + outlineThickness, bottom + outlineThickness, colour);
+		AddQuad(layer, left - outlineThickness, top, left, bottom, colour);
+		AddQuad(layer, right, top, right + outlineThickness, bottom, colour);
+	}
+	return layerCount;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+
+/* Visuals --------------------------------------------------------------------------------------------------------------------------
+ * Vertices for drawing every object and every bvh node in a handful of draw calls rather than one call each.
+ * They are worked out on the CPU without SFML, so they can be generated and checked headless, and only need
+ * working out again when bounds change. Every layer is a list of quads, four corners each in the order sf::Quads takes them.
+ */
+
+struct VisualColour {
+	uint8_t r = 0;
+	uint8_t g = 0;
+	uint8_t b = 0;
+	uint8_t a = 255;
+};
+
+struct VisualVertex {
+	float x;
+	float y;
+	VisualColour colour;
+};
+
+// One filled quad per object of bounds, coloured by colours[object]
+void BuildObjectVertices(const GameObjectBounds& bounds, const std::vector<VisualColour>& colours, std::vector<VisualVertex>& vertices);
+
+/* The outline of every node, drawn just outside its bounds like the outline of an sf::RectangleShape.
+ * layers[depth] holds the nodes at that depth, the root being depth 0, so the tree can be drawn a level at a time.
+ * Returns the number of depths. Layers past it are left empty rather than removed, so they keep their memory between calls.
+ */
+uint32_t BuildNodeVertices(const std::vector<Node>& nodes, float outlineThickness, VisualColour colour, std::vector<std::vector<VisualVertex>>& layers);
@@ -1,4 +1,3 @@
-#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <sstream>
@@ -6,9 +5,14 @@
 #include <vector>
 #include <random>
 #include <cstdlib>
+#include <cstdint>
 
 #include <SFML/Graphics.hpp>
 
+#include "BVH.h"
+#include "SceneFile.h"
+#include "Visuals.h"
+
 #define LOG(x) std::cout << x << std::endl;
 
 struct APPLICATION_SETTINGS {
@@ -19,136 +23,79 @@ struct APPLICATION_SETTINGS {
 APPLICATION_SETTINGS APP_SETTINGS;
 
 float fullSearch_timeInMs = 0.0f;
-float bvhRecursive_timeInMs = 0.0f;
-
-struct FloatRect {
-	FloatRect() = default;
-	FloatRect(float _left, float _top, float _width, float _height) {
-		left = _left;
-		top = _top;
-		width = _width;
-		height = _height;
-	}
-
-	float left = 0;
-	float top = 0;
-	float width = 0;
-	float height = 0;
-};
-
-struct GameObject {
-	GameObject(std::string _name, FloatRect _boundingBox) {
-		name = _name;
-		boundingBox = _boundingBox;
-
-		/* SFML Specifics */
-		bbVisual.setPosition(boundingBox.left, boundingBox.top);
-		bbVisual.setSize({ _boundingBox.width, _boundingBox.height });
-
-		int rR = rand() % 255;
-		int rG= rand() % 255;
-		int rB= rand() % 255;
-		bbVisual.setFillColor(sf::Color(rR, rG, rB));
-	}
-
-	bool operator<(const GameObject& externalObj)
-	{
-		return this->boundingBox.left < externalObj.boundingBox.left;
-	}
-
-	std::string name;
-	FloatRect boundingBox;
-	sf::RectangleShape bbVisual;
-};
-
-struct Node {
-	Node() = default;
-
-	// Defines GameObjects within that node
-	void DefineGameObjects(std::vector<GameObject*> gameObjectsInNode)
-	{
-		gameObjects = gameObjectsInNode;
-	}
-	// Bounds of the Node
-	void DefineBounds(float _left, float _top, float _width, float _height)
-	{
-		boundingBox.left = _left;
-		boundingBox.top = _top;
-		boundingBox.width = _width;
-		boundingBox.height = _height;
-
-		/* SFML Stuff */
-		bbVisual.setPosition(boundingBox.left, boundingBox.top);
-		bbVisual.setSize({ boundingBox.width, boundingBox.height });
-		bbVisual.setOutlineColor(sf::Color::Red);
-		bbVisual.setOutlineThickness(3);
-		bbVisual.setFillColor(sf::Color(0, 0, 0, 0));
-	}
-	// Define the previous nodes and child nodes
-	void DefineChildA(Node* _childA)
-	{
-		this->childA = _childA;
-	}
-
-	void DefineChildB(Node* _childB)
-	{
-		this->childB = _childB;
-	}
-
-	void DefineParentNode(Node* _parentNode)
-	{
-		this->previousNode = _parentNode;
-	}
+float bvhTraverse_timeInMs = 0.0f;
 
-	Node* previousNode = nullptr;
-	Node* childA = nullptr;
-	Node* childB = nullptr;
+std::vector<std::string> gameObjectNames;
+std::vector<VisualColour> gameObjectColours;
 
-	std::vector<GameObject*> gameObjects;
-	FloatRect boundingBox;
-	sf::RectangleShape bbVisual;
-};
-
-std::vector<GameObject> gameObjects;
-std::vector<Node*> bvh;
+/* SFML Specifics, one vertex array for the objects and one per depth of the bvh.
+ * Only filled again when visualsChanged says some bounds have moved since the last frame
+ */
+std::vector<VisualVertex> objectVertices;
+std::vector<std::vector<VisualVertex>> nodeVertices;
+sf::VertexArray objectVisuals(sf::Quads);
+std::vector<sf::VertexArray> bvhVisuals;
+bool visualsChanged = true;
 
 
 // TODO: Will be removed, only for debug purposes
 /* Ignores bvh and manually checks all the collisions with every GameObject
  * Useful to check if the bvh is working correctly
  */
-std::vector<GameObject*> tempCollisions;
+std::vector<uint32_t> tempCollisions;
 
 FloatRect birdObject = {90, 128, 32, 32};
-std::vector<Node*> collidedNodes;		// Each bird in angry birds will have this
-std::vector<GameObject*> collidedObjects;
+std::vector<uint32_t> collidedObjects;		// Each bird in angry birds will have this
+QueryContext birdQueryContext;			// And this, so each frame's query starts where the last one left off
 
-// Example of GameObjects within an application
-void CreateGameObjects()
+// Adds the cold side tables of a GameObject whose bounds are already in gameObjectBounds
+void AddGameObjectVisual(const std::string& name)
 {
-	// Creation of example obbjects
-	gameObjects.emplace_back("circle", FloatRect(0, 0, 64, 64));
-	gameObjects.emplace_back("chair", FloatRect(119, 0, 64, 64));
-	gameObjects.emplace_back("dino", FloatRect(280 * 2.2f, 0, 64, 64));
-	gameObjects.emplace_back("obama", FloatRect(395 * 3, 0, 64, 64));
-	gameObjects.emplace_back("chicken", FloatRect(86, 128 * 1.2f, 64, 64));
-	gameObjects.emplace_back("jockey", FloatRect(107, 128, 64, 64));
-	gameObjects.emplace_back("frog", FloatRect(230, 128 * 3.17f, 64, 64));
-	gameObjects.emplace_back("shark", FloatRect(297 * 3.1f, 128 * 4, 64, 64));
+	gameObjectNames.push_back(name);
+
+	VisualColour colour;
+	colour.r = static_cast<uint8_t>(rand() % 255);
+	colour.g = static_cast<uint8_t>(rand() % 255);
+	colour.b = static_cast<uint8_t>(rand() % 255);
+	gameObjectColours.push_back(colour);
+	visualsChanged = true;
 }
 
-bool BoxBoxCollision(FloatRect boxA, FloatRect boxB)
+// Adds a GameObject to the hot bounds arrays and the cold side tables
+void AddGameObject(const std::string& name, FloatRect boundingBox)
 {
-	if (boxA.left < boxB.left + boxB.width &&
-			boxA.left + boxA.width > boxB.left &&
-			boxA.top + boxA.height > boxB.top &&
-			boxA.top < boxB.top + boxB.height)
+	gameObjectBounds.Add(boundingBox);
+	AddGameObjectVisual(name);
+}
+
+// Loads the GameObjects of a binary or CSV scene file, see SceneFile.h. Loaded objects are named after their index
+bool LoadGameObjects(const char* scenePath)
+{
+	if (!LoadScene(scenePath))
+	{
+		LOG("Could not load scene " << scenePath)
+		return false;
+	}
+	for (uint32_t object = static_cast<uint32_t>(gameObjectNames.size()); object < gameObjectBounds.Size(); object++)
 	{
-		return true;
+		AddGameObjectVisual("object " + std::to_string(object));
 	}
-	return false;
+	return true;
 }
 
+// Example of GameObjects within an application
+void CreateGameObjects()
+{
+	// Creation of example obbjects
+	AddGameObject("circle", FloatRect(0, 0, 64, 64));
+	AddGameObject("chair", FloatRect(119, 0, 64, 64));
+	AddGameObject("dino", FloatRect(280 * 2.2f, 0, 64, 64));
+	AddGameObject("obama", FloatRect(395 * 3, 0, 64, 64));
+	AddGameObject("chicken", FloatRect(86, 128 * 1.2f, 64, 64));
+	AddGameObject("jockey", FloatRect(107, 128, 64, 64));
+	AddGameObject("frog", FloatRect(230, 128 * 3.17f, 64, 64));
+	AddGameObject("shark", FloatRect(297 * 3.1f, 128 * 4, 64, 64));
+}
 
 // DEBUG STUFF  ---------------------------------------------------------------------------------------------------------------------
 
@@ -157,225 +104,140 @@ bool BoxBoxCollision(FloatRect boxA, FloatRect boxB)
 void CheckCollison(FloatRect collisionBox)
 {
 	auto t1 = std::chrono::high_resolution_clock::now();
-	for (GameObject& object : gameObjects)
-	{
-		if (BoxBoxCollision(collisionBox, object.boundingBox))
-		{
-			tempCollisions.push_back(&object);
-		}
-	}
+	BruteForceQuery(collisionBox, [](uint32_t object) { tempCollisions.push_back(object); });
 	auto t2 = std::chrono::high_resolution_clock::now();
 	std::chrono::duration<float, std::milli> time = t2 - t1;
 	fullSearch_timeInMs += time.count();
 }
 
 size_t printCounter = 0;
-void PrintGameObjectNames(std::vector<GameObject*> myVec)
+void PrintGameObjectNames(const std::vector<uint32_t>& myVec)
 {
 	LOG("-------------- Printing objects, counter: " + std::to_string(printCounter) + " --------------")
-	for (GameObject* object : myVec)
+	for (uint32_t object : myVec)
 	{
-		LOG(object->name)
+		LOG(gameObjectNames[object])
 	}
 	LOG("-------------- Printing objects end --------------")
 	printCounter++;
 }
 
-// BVH Stuff ------------------------------------------------------------------------------------------------------------------------
-
-void OrganiseGameObjects()
+// Moves an object, the bvh is not touched until RefitBVH is called with it
+void MoveGameObject(uint32_t object, FloatRect boundingBox)
 {
-	std::sort(gameObjects.begin(), gameObjects.end());
+	gameObjectBounds.Set(object, boundingBox);
+	visualsChanged = true;
 }
 
-std::vector<GameObject*> ConvertVectorType(std::vector<GameObject>& gameObjectVector)
+// The arrow keys move the first GameObject a step at a time, refitting the bvh around it
+void MoveWithArrowKey(sf::Keyboard::Key key)
 {
-	std::vector<GameObject*> newVector;
-	for (GameObject& object : gameObjectVector)
+	const float step = 16.0f;
+	FloatRect boundingBox = gameObjectBounds.Get(0);
+	switch (key)
 	{
-		newVector.push_back(&object);
+	case sf::Keyboard::Left: boundingBox.left -= step; break;
+	case sf::Keyboard::Right: boundingBox.left += step; break;
+	case sf::Keyboard::Up: boundingBox.top -= step; break;
+	case sf::Keyboard::Down: boundingBox.top += step; break;
+	default: return;
 	}
-	return newVector;
+	MoveGameObject(0, boundingBox);
+	RefitBVH({ 0 });
 }
 
-void CreateNewNode(Node* currentNode)
+// SFML Specifics
+void CopyVertices(const std::vector<VisualVertex>& vertices, sf::VertexArray& visual)
 {
-	// End node creation if the number of objects in the current node is 2 or less
-	if (currentNode->gameObjects.size() <= 2)
+	visual.setPrimitiveType(sf::Quads);
+	visual.resize(vertices.size());
+	for (size_t vertex = 0; vertex < vertices.size(); vertex++)
 	{
-		// This node is now a leaf node
-		return;
+		const VisualVertex& source = vertices[vertex];
+		visual[vertex].position = sf::Vector2f(source.x, source.y);
+		visual[vertex].color = sf::Color(source.colour.r, source.colour.g, source.colour.b, source.colour.a);
 	}
-
-	Node* childA = new Node();		// ChildA
-	bvh.emplace_back(childA);
-	currentNode->DefineChildA(childA);
-
-	Node* childB = new Node();		// ChildB
-	bvh.emplace_back(childB);
-	currentNode->DefineChildB(childB);
-
-	// Assign parent node of both children
-	currentNode->childA->DefineParentNode(currentNode);
-	currentNode->childB->DefineParentNode(currentNode);
-
-	// Divide and conqour
-	size_t midPoint = currentNode->gameObjects.size() / 2;
-	std::vector<GameObject*> leftSide = {currentNode->gameObjects.begin(), currentNode->gameObjects.begin() + midPoint};
-	std::vector<GameObject*> rightSide = {currentNode->gameObjects.begin() + midPoint, currentNode->gameObjects.end()};
-
-	// Define objects in the next node
-	currentNode->childA->DefineGameObjects(leftSide);
-	currentNode->childB->DefineGameObjects(rightSide);
-
-	// Recurse to child nodes
-	CreateNewNode(currentNode->childA);
-	CreateNewNode(currentNode->childB);
-}
-
-void CalculateNodeBounds(Node* currentNode)
-{
-	// We know the smallest and largest x as those are at the start and end of the vector
-	float smallestX = currentNode->gameObjects.front()->boundingBox.left;
-	float largestX = currentNode->gameObjects.back()->boundingBox.left + currentNode->gameObjects.back()->boundingBox.width;
-
-	// Ensure there are default values
-	float smallestY = currentNode->boundingBox.top;
-	float largestY = currentNode->boundingBox.top + currentNode->boundingBox.height;
-
-	// Find smallest and largest Y values
-	for (GameObject* object : currentNode->gameObjects)
-	{
-		smallestY = std::min(object->boundingBox.top, smallestY);
-		largestY = std::max(object->boundingBox.top + object->boundingBox.height, largestY);
-	}
-
-	currentNode->DefineBounds(smallestX, smallestY, largestX - smallestX, largestY - smallestY);
-
-	if (currentNode->childA != nullptr)
-	{
-		CalculateNodeBounds(currentNode->childA);
-	}
-	if (currentNode->childB != nullptr)
-	{
-		CalculateNodeBounds(currentNode->childB);
-	}
-
-}
-
-
-void CreateBVH()
-{
-	/* Steps to create a BVH
-	 * 1. Organise the objects in the vector from smallest x to largest x - done
-	 * 2. Create a master node which contains a vector of GameObject pointers - done
-	 * 3. Start recursion by passing in the master node
-	 * 4. Create two nodes - done
-	 * 5. Assign the two new nodes as childA and childB of the current node - done
-	 * 6. Find the midpoint of the current node vector - done
-	 * 7. Left side of midpoint goes to childA, while right of midpoint goes to childB - done
-	 * 8. Repeat steps 4 to 8 using recursion until the number of gameObjects in that node is 2 or less - done
-	 * 9. Calculate the bounds of all nodes using the gameObjects
-	 */
-	auto t1 = std::chrono::high_resolution_clock::now();
-	OrganiseGameObjects();
-
-	// Create master node
-	Node* masterNode = new Node();
-	bvh.emplace_back(masterNode);
-	masterNode->DefineGameObjects(ConvertVectorType(gameObjects));
-
-	// Start creating bvh
-	CreateNewNode(masterNode);
-
-	// Calculate the bounds of all the nodes
-	CalculateNodeBounds(masterNode);
-
-	auto t2 = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<float, std::milli> time = t2 - t1;
-	LOG("Time to create BVH: " + std::to_string(time.count()) + "ms")
-
 }
 
-/* Set this to node as of now due to BVH creation not adding gameobjects correctly */
-void RecursiveSearchBVH(FloatRect searchRect, Node* currentNode) 
+// Fills the vertex arrays from the current bounds and bvh, red outlines for every node
+void UpdateVisuals()
 {
-	// Do not continue if this node is a nullptr
-	if (currentNode == nullptr)
-	{
-		return;
-	}
-	// If the searchRect is not within this current node, do not proceed
-	if (!BoxBoxCollision(searchRect, currentNode->boundingBox))
-	{
-		return;
-	}
-	// Go to child nodes if there are more than 2 objects in this current node
-	if (currentNode->gameObjects.size() > 2)
-	{
-		RecursiveSearchBVH(searchRect, currentNode->childA);
-		RecursiveSearchBVH(searchRect, currentNode->childB);
-		return;
-	}
-	// If this is not a nullptr, the searchRect is within this node, and there are two or fewer objects with this node, then write it down
-	collidedNodes.emplace_back(currentNode);
-	
-}
+	BuildObjectVertices(gameObjectBounds, gameObjectColours, objectVertices);
+	CopyVertices(objectVertices, objectVisuals);
 
-void CheckCollisionsWithinNodes(FloatRect boundingBox)
-{
-	for (Node* node : collidedNodes)
+	uint32_t depthCount = BuildNodeVertices(bvh, 3.0f, { 255, 0, 0, 255 }, nodeVertices);
+	bvhVisuals.resize(depthCount);
+	for (uint32_t depth = 0; depth < depthCount; depth++)
 	{
-		// Check collisions with object inside of node
-		for (GameObject* object : node->gameObjects)
-		{
-			if (BoxBoxCollision(boundingBox, object->boundingBox))
-			{
-				collidedObjects.emplace_back(object);
-			}
-		}
+		CopyVertices(nodeVertices[depth], bvhVisuals[depth]);
 	}
+	visualsChanged = false;
 }
 
 
-int main()
+// Pass the path of a scene file to load it instead of the example GameObjects
+int main(int argc, char** argv)
 {
 	/* Seed random */
 	srand(time(0));
 
 	// Creation of BVH and GameObjects
-	CreateGameObjects();
+	if (argc < 2 || !LoadGameObjects(argv[1]))
+	{
+		CreateGameObjects();
+	}
 	CreateBVH();
+	LOG("Time to create BVH: " + std::to_string(bvhBuild_timeInMs) + "ms")
+	visualsChanged = true;
 
 	// Check all of the collisions
 	CheckCollison(birdObject);
 
 	auto t1 = std::chrono::high_resolution_clock::now();
-	// Traverse through the bvh, then check objects within that node
-	RecursiveSearchBVH(birdObject, bvh[0]);
-	CheckCollisionsWithinNodes(birdObject);
+	// Traverse through the bvh, checking objects within each leaf node as they are reached
+	QueryBVHCoherent(birdQueryContext, birdObject, [](uint32_t object) { collidedObjects.emplace_back(object); });
 
 	auto t2 = std::chrono::high_resolution_clock::now();
 	std::chrono::duration<float, std::milli> time = t2 - t1;
-	bvhRecursive_timeInMs += time.count();
+	bvhTraverse_timeInMs += time.count();
 
 	// DEBUG ONLY - manually check all collisions to compare with bvh
-	for (GameObject* object : tempCollisions)
+	for (uint32_t object : tempCollisions)
 	{
-		LOG("DEBUG, object collided with: " + object->name)
+		LOG("DEBUG, object collided with: " + gameObjectNames[object])
 	}
 	LOG("")
 	// Print out objects hit by traversing bvh
-	for (GameObject* object : collidedObjects) 
+	for (uint32_t object : collidedObjects) 
 	{
-		std::cout << "BVH, Object collided with: " << object->name << "\n";
+		std::cout << "BVH, Object collided with: " << gameObjectNames[object] << "\n";
 	}
 	LOG("")
 
 	std::cout << "Size of Full Search collisionQueue: " << tempCollisions.size() << std::endl;
 	std::cout << "Full Search time to complete : " << fullSearch_timeInMs << "ms" << std::endl;
-	std::cout << "Size of BVH Traverse collisionQueue: " << collidedNodes.size() << std::endl;
-	std::cout << "BVH Traverse time to complete : " << bvhRecursive_timeInMs << "ms" << std::endl;
+	std::cout << "Size of BVH Traverse collisionQueue: " << collidedObjects.size() << std::endl;
+	std::cout << "BVH Traverse time to complete : " << bvhTraverse_timeInMs << "ms" << std::endl;
+
+	// Line of fire straight to the right of the bird, the bird itself is not a GameObject so nothing needs filtering
+	float birdCentreY = birdObject.top + birdObject.height * 0.5f;
+	RayHit lineOfFire = CastRay(SegmentRay(birdObject.left + birdObject.width, birdCentreY, APP_SETTINGS.SCREEN_WIDTH, birdCentreY));
+	if (lineOfFire.object != NULL_OBJECT)
+	{
+		std::cout << "Line of fire hits: " << gameObjectNames[lineOfFire.object] << " at t = " << lineOfFire.t << std::endl;
+	}
+
+	// Closest GameObjects to the bird, e.g. for picking a target
+	NearestObjects nearestToBird;
+	FindNearestObjects(birdObject, 3, nearestToBird);
+	for (const NearestObject& neighbour : nearestToBird.objects)
+	{
+		std::cout << "Near the bird: " << gameObjectNames[neighbour.object] << ", squared distance " << neighbour.distanceSquared << std::endl;
+	}
+
+	size_t overlappingPairs = 0;
+	FindCollidingPairs([&overlappingPairs](uint32_t, uint32_t) { overlappingPairs++; });
+	std::cout << "Overlapping GameObject pairs: " << overlappingPairs << std::endl;
 
 	sf::RenderWindow window(sf::VideoMode({ APP_SETTINGS.SCREEN_WIDTH, APP_SETTINGS.SCREEN_HEIGHT }), APP_SETTINGS.APPLICATION_NAME);
 
@@ -386,21 +248,27 @@ int main()
 		{
 			if (event.type == sf::Event::Closed)
 				window.close();
+			else if (event.type == sf::Event::KeyPressed && gameObjectBounds.Size() > 0)
+				MoveWithArrowKey(event.key.code);
 		}
 
 		window.clear();
 
-		/* Objects Visualisation */
-		for (auto go : gameObjects) {
-		    window.draw(go.bbVisual);
+		if (visualsChanged)
+		{
+			UpdateVisuals();
 		}
-		/* BVH Visualisation */
-		for (auto node : bvh) {
-			window.draw(node->bbVisual);
+
+		/* Objects Visualisation */
+		window.draw(objectVisuals);
+		/* BVH Visualisation, a draw call per depth rather than per node */
+		for (const sf::VertexArray& visual : bvhVisuals)
+		{
+			window.draw(visual);
 		}
 
 		window.display();
 	}
 
 	return 0;
-}
\ No newline at end of file
+}